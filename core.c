@@ -0,0 +1,969 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "vnpu.h"
+#include "probes.h"
+
+//
+void w(int millisec)
+{
+    int microsec = millisec * 1000;
+	usleep(microsec);
+}
+
+void Tick(struct VNPU *vm)
+{
+    vm->cycles++;
+    if (vm->throttle)
+        w(337);
+}
+
+// TODO: Misleading function name
+char FindInstruction(char InstrBuff[])
+{
+    switch (InstrBuff[0])
+    {
+        case '+': case '-': case '*':
+        case '/': case 'M': case '?':
+        case '>': case '<': case '!':
+        case '@': case '.': case 'H':
+        case 'I': case 'O':
+        case 'L': case 'S': case 'X':
+        case 'C': case 'F': case 'W':
+        case '#':
+            return '0';
+        default:
+            return 'e';
+    }
+}
+
+void dec2bin2reg(uint64_t reg[VNPU_LIMBS], const uint64_t val[]) // dst, src
+{
+    WideCopy(reg, val, VNPU_LIMBS);
+    WideMask(reg, VNPU_WORD_SIZE, VNPU_LIMBS);
+}
+
+void dec2bin2mem(struct VNPU *vm, const uint64_t result[2 * VNPU_LIMBS])
+{
+    WideGetBits(vm->MEM[1], VNPU_LIMBS, result, 2 * VNPU_LIMBS, 0, VNPU_WORD_SIZE);
+    WideGetBits(vm->MEM[0], VNPU_LIMBS, result, 2 * VNPU_LIMBS, VNPU_WORD_SIZE, VNPU_WORD_SIZE);
+}
+
+int RegisterIndex(char c)
+{
+    if (c < 'A' || c >= 'A' + VNPU_REGS) return -1;
+    return c - 'A';
+}
+
+int ResolveOperand(struct VNPU *vm, char c, uint64_t val[VNPU_LIMBS])
+{
+    if (isdigit((unsigned char)c))
+    {
+        WideSet(val, (uint64_t)(c - '0'), VNPU_LIMBS);
+        WideMask(val, VNPU_WORD_SIZE, VNPU_LIMBS); // 1..3-bit words, if you must
+        return 0;
+    }
+
+    int r = RegisterIndex(c);
+    if (r >= 0)
+    {
+        WideCopy(val, vm->R[r], VNPU_LIMBS);
+        return 0;
+    }
+
+    return -1; // invalid shid
+}
+
+// StoreResult ( struct VNPU *vm, const uint64_t result[2 * VNPU_LIMBS], char com3 )
+// ⤷ Where every arithmetic op leaves its double-width result: the low word in
+//   AX ( or the register com3 names ), both words in MEM. Returns -1 if com3
+//   names no register, having stored nothing.
+static int StoreResult(struct VNPU *vm, const uint64_t result[2 * VNPU_LIMBS], char com3)
+{
+    int r = com3 == '\0' ? 0 : RegisterIndex(com3);
+    if (r < 0) return -1;
+
+    dec2bin2reg(vm->R[r], result);
+    dec2bin2mem(vm, result);
+    VNPU_PROBE_REG(vm, 'A' + r, vm->R[r][0]);
+    VNPU_PROBE_REG(vm, 'M', vm->MEM[1][0]);
+    return 0;
+}
+
+void PrintWord(struct VNPU *vm, const uint64_t word[VNPU_LIMBS])
+{
+#if VNPU_LIMBS == 1
+    VnpuPrint(vm, "%llu\n", (unsigned long long)word[0]);
+#else
+    char buf[VNPU_LIMBS * 20 + 1];
+    WideToDec(buf, sizeof buf, word, VNPU_LIMBS);
+    VnpuPrint(vm, "%s\n", buf);
+#endif
+}
+
+bool HandleInstruction(struct VNPU *vm, char instr, char com1, char com2, char com3)
+{
+    VNPU_PROBE_INSN(vm, instr, com1, com2);
+
+	if (instr == '+')
+    {
+		int code = AddInstruction(vm, com1, com2, com3);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '-')
+	{
+		int code = SubInstruction(vm, com1, com2, com3);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '*')
+	{
+		int code = MulInstruction(vm, com1, com2, com3);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '/')
+	{
+		int code = DivInstruction(vm, com1, com2, com3);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == 'M')
+	{
+		int code = MovInstruction(vm, com1, com2);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '?')
+	{
+		int code = CmpInstruction(com1, com2);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '>')
+	{
+		int code = GrThInstruction(com1, com2);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '<')
+	{
+		int code = LsThInstruction(com1, com2);
+		if (code != 0) return false;
+		else return true;
+	}
+	else if (instr == '!')
+	{
+		int code = NotEqInstruction(com1, com2);
+		if (code != 0) return false;
+		else return true;
+	}
+    else if (instr == 'I')
+    {
+        int code = InInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'O')
+    {
+        int code = OutInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'L')
+    {
+        int code = LoadInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'S')
+    {
+        int code = StoreInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'X')
+    {
+        int code = XaddInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'C')
+    {
+        int code = CasInstruction(vm, com1, com2);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'F')
+    {
+        int code = FenceInstruction(vm);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == 'W')
+    {
+        int code = WaitInstruction(vm);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == '#')
+    {
+        int code = CoreInstruction(vm, com1);
+        if (code != 0) return false;
+        else return true;
+    }
+    else if (instr == '@')
+    {
+        PrntInstruction(vm, com1);
+        return true;
+    }
+    else if (instr == 'H')
+    {
+        printUsage(vm);
+        return true;
+    }
+    return false;
+}
+
+//
+int AddInstruction(struct VNPU *vm, char com1, char com2, char com3)
+{
+    Tick(vm);
+
+    uint64_t v1[VNPU_LIMBS], v2[VNPU_LIMBS];
+    if (ResolveOperand(vm, com1, v1) < 0 || ResolveOperand(vm, com2, v2) < 0) return 1;
+
+    uint64_t result[2 * VNPU_LIMBS] = {0};
+    result[VNPU_LIMBS] = WideAdd(result, v1, v2, VNPU_LIMBS);
+
+    return StoreResult(vm, result, com3) < 0;
+}
+
+int SubInstruction(struct VNPU *vm, char com1, char com2, char com3)
+{
+    Tick(vm);
+
+    uint64_t v1[VNPU_LIMBS], v2[VNPU_LIMBS];
+    if (ResolveOperand(vm, com1, v1) < 0 || ResolveOperand(vm, com2, v2) < 0) return 1;
+
+    // a borrow out sign-extends the result, like a negative int used to
+    uint64_t result[2 * VNPU_LIMBS];
+    uint64_t fill = WideSub(result, v1, v2, VNPU_LIMBS) ? ~UINT64_C(0) : 0;
+    for (int i = VNPU_LIMBS; i < 2 * VNPU_LIMBS; ++i)
+        result[i] = fill;
+
+    return StoreResult(vm, result, com3) < 0;
+}
+int MulInstruction(struct VNPU *vm, char com1, char com2, char com3)
+{
+    Tick(vm);
+
+    uint64_t v1[VNPU_LIMBS], v2[VNPU_LIMBS];
+    if (ResolveOperand(vm, com1, v1) < 0 || ResolveOperand(vm, com2, v2) < 0) return 1;
+
+    uint64_t result[2 * VNPU_LIMBS];
+    WideMul(result, v1, v2, VNPU_LIMBS);
+
+    return StoreResult(vm, result, com3) < 0;
+}
+int DivInstruction(struct VNPU *vm, char com1, char com2, char com3)
+{
+	Tick(vm);
+
+    uint64_t v1[VNPU_LIMBS], v2[VNPU_LIMBS];
+    if (ResolveOperand(vm, com1, v1) < 0 || ResolveOperand(vm, com2, v2) < 0) return 1;
+    if (WideIsZero(v2, VNPU_LIMBS))
+    {
+        vm->HaltReason = VNPU_HALT_DIVZERO; // VnpuStep() does the rest
+        return 1;
+    }
+
+    uint64_t result[2 * VNPU_LIMBS] = {0};
+    WideDiv(result, v1, v2, VNPU_LIMBS);
+
+    return StoreResult(vm, result, com3) < 0;
+}
+int MovInstruction(struct VNPU *vm, char com1, char com2)
+{
+    Tick(vm);
+
+    /* register-to-register ( never onto itself ), immediate-to-register */
+    int dst = RegisterIndex(com2);
+    if (dst < 0 || com1 == com2) return 1;
+
+    uint64_t val[VNPU_LIMBS];
+    if (ResolveOperand(vm, com1, val) < 0) return 1;
+
+    dec2bin2reg(vm->R[dst], val);
+    VNPU_PROBE_REG(vm, com2, vm->R[dst][0]);
+
+    return 0;
+}
+//
+bool CmpInstruction(char com1, char com2)
+{
+	// just check if com1 == com2 (?)
+	if (com1 == com2)
+		return true;
+	else return false;
+}
+bool GrThInstruction(char com1, char com2)
+{
+	// same
+	if (com1 > com2)
+		return true;
+	else return false;
+}
+bool LsThInstruction(char com1, char com2)
+{
+	if (com1 < com2)
+		return true;
+	else return false;
+}
+bool NotEqInstruction(char com1, char com2)
+{
+	if (com1 != com2)
+		return true;
+	else return false;
+}
+//
+int InInstruction(struct VNPU *vm, char com1, char com2)
+{
+    if (com1 < '0' || com1 >= '0' + VNPU_PORT_COUNT) return 1;
+    int dst = RegisterIndex(com2);
+    if (dst < 0) return 1;
+
+    uint64_t word = 0;
+    int status = vm->ports ? vm->ports->In(vm->ports->ctx, com1 - '0', &word) : VNPU_PORT_CLOSED;
+    if (status == VNPU_PORT_BLOCKED)
+    {
+        vm->blocked = true;
+        return 0;
+    }
+    if (status != VNPU_PORT_OK)
+    {
+        vm->HALT = true;
+        vm->HaltReason = VNPU_HALT_IN_CLOSED;
+        VNPU_PROBE_HALT(vm, vm->HaltReason);
+        return 0;
+    }
+    VNPU_PROBE_IN(vm, com1 - '0', word);
+
+    uint64_t val[VNPU_LIMBS];
+    WideSet(val, word, VNPU_LIMBS);
+    dec2bin2reg(vm->R[dst], val);
+    VNPU_PROBE_REG(vm, com2, vm->R[dst][0]);
+    return 0;
+}
+int OutInstruction(struct VNPU *vm, char com1, char com2)
+{
+    if (com1 < '0' || com1 >= '0' + VNPU_PORT_COUNT) return 1;
+
+    uint64_t val[VNPU_LIMBS];
+    if (ResolveOperand(vm, com2, val) < 0) return 1;
+
+    // ports carry the low 64 bits of a word
+    VNPU_PROBE_OUT(vm, com1 - '0', val[0]);
+    if (vm->ports && vm->ports->Out(vm->ports->ctx, com1 - '0', val[0]) == VNPU_PORT_BLOCKED)
+        vm->blocked = true;
+    return 0;
+}
+//
+// SharedWord ( struct VNPU *vm, char c )
+// ⤷ The shared word a digit addresses, NULL if there is none. Shared words are
+//   64 bits, so wider machines have none at all.
+static _Atomic uint64_t *SharedWord(struct VNPU *vm, char c)
+{
+    if (!vm->shared || VNPU_LIMBS > 1) return NULL;
+    if (c < '0' || c >= '0' + VNPU_SHARED_WORDS) return NULL;
+    return &vm->shared->mem[c - '0'].word;
+}
+
+// SetRegister ( struct VNPU *vm, char reg, uint64_t word )
+// ⤷ Register 'reg' gets the low VNPU_WORD_SIZE bits of 'word'
+static void SetRegister(struct VNPU *vm, char reg, uint64_t word)
+{
+    uint64_t val[VNPU_LIMBS];
+    WideSet(val, word, VNPU_LIMBS);
+    dec2bin2reg(vm->R[RegisterIndex(reg)], val);
+    VNPU_PROBE_REG(vm, reg, vm->R[RegisterIndex(reg)][0]);
+}
+
+// Shared words hold the low VNPU_WORD_SIZE bits of a word, plus whatever
+// 'X' carried out of them: they're masked on the way out.
+int LoadInstruction(struct VNPU *vm, char com1, char com2)
+{
+    _Atomic uint64_t *word = SharedWord(vm, com1);
+    if (!word) return 1;
+    if (RegisterIndex(com2) < 0) return 1;
+
+    SetRegister(vm, com2, atomic_load_explicit(word, memory_order_acquire));
+    return 0;
+}
+int StoreInstruction(struct VNPU *vm, char com1, char com2)
+{
+    _Atomic uint64_t *word = SharedWord(vm, com1);
+    uint64_t val[VNPU_LIMBS];
+    if (!word || ResolveOperand(vm, com2, val) < 0) return 1;
+
+    atomic_store_explicit(word, val[0], memory_order_release);
+    return 0;
+}
+int XaddInstruction(struct VNPU *vm, char com1, char com2)
+{
+    _Atomic uint64_t *word = SharedWord(vm, com1);
+    uint64_t val[VNPU_LIMBS];
+    if (!word || ResolveOperand(vm, com2, val) < 0) return 1;
+
+    SetRegister(vm, 'A', atomic_fetch_add(word, val[0]));
+    return 0;
+}
+int CasInstruction(struct VNPU *vm, char com1, char com2)
+{
+    _Atomic uint64_t *word = SharedWord(vm, com1);
+    uint64_t val[VNPU_LIMBS];
+    if (!word || ResolveOperand(vm, com2, val) < 0) return 1;
+
+    // compares the masked word, so retry if only the bits above it moved
+    uint64_t mask = VNPU_WORD_SIZE < 64 ? (UINT64_C(1) << (VNPU_WORD_SIZE % 64)) - 1 : ~UINT64_C(0);
+    uint64_t old = atomic_load(word);
+    while ((old & mask) == vm->AX[0] && !atomic_compare_exchange_weak(word, &old, val[0]))
+        ;
+    SetRegister(vm, 'A', old);
+    return 0;
+}
+int FenceInstruction(struct VNPU *vm)
+{
+    if (!vm->shared) return 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    return 0;
+}
+int WaitInstruction(struct VNPU *vm)
+{
+    struct VnpuShared *sh = vm->shared;
+    if (!sh) return 1;
+
+    if (!vm->waiting)
+    {
+        // arrive: the last one in opens the barrier instead of waiting
+        vm->wait_gen = atomic_load(&sh->generation);
+        uint64_t b = atomic_load(&sh->barrier);
+        uint64_t next;
+        bool last;
+        do
+        {
+            last = (b & UINT32_MAX) + 1 == b >> 32;
+            next = last ? b >> 32 << 32 : b + 1;
+        } while (!atomic_compare_exchange_weak(&sh->barrier, &b, next));
+        if (last)
+        {
+            atomic_fetch_add(&sh->generation, 1);
+            return 0;
+        }
+        vm->waiting = true;
+    }
+
+    // closed: VnpuRun() backs out of the op and it's run again later
+    if (atomic_load(&sh->generation) == vm->wait_gen)
+    {
+        vm->blocked = true;
+        return 0;
+    }
+    vm->waiting = false;
+    return 0;
+}
+int CoreInstruction(struct VNPU *vm, char com1)
+{
+    if (!vm->shared) return 1;
+    if (RegisterIndex(com1) < 0) return 1;
+
+    SetRegister(vm, com1, vm->core);
+    return 0;
+}
+//
+void PrntInstruction(struct VNPU *vm, char com1)
+{
+    int r = RegisterIndex(com1);
+    if (r >= 0 && vm->ports && vm->ports->print_out)
+    {
+        if (vm->ports->Out(vm->ports->ctx, VNPU_PORT_PRINT, vm->R[r][0]) == VNPU_PORT_BLOCKED)
+            vm->blocked = true;
+    }
+    else if (r >= 0)
+    {
+        PrintWord(vm, vm->R[r]);
+    }
+    else
+    {
+	    VnpuPrint(vm, "%c\n", com1);
+    }
+}
+void HaltInstruction(struct VNPU *vm)
+{
+	vm->HALT = true;
+	vm->HaltReason = VNPU_HALT_INSTR;
+	VNPU_PROBE_HALT(vm, vm->HaltReason);
+}
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+const char VnpuUsageText[] =
+    "========================\n"
+    "VNPU Instruction Set (v'NIS)\n"
+    "-----REGISTERS------\n"
+    "'A': Register AX\n"
+    "'B': Register BX\n"
+#if VNPU_REGS > 2
+    "'C'..: Registers CX, DX and on, " STRINGIFY(VNPU_REGS) " registers in all\n"
+#endif
+    "-----OPERATIONS-----\n"
+    "'+': Adds X by Y. (Example: '+ A B' adds register AX and BX, '+ A B B' stores the result in BX)\n"
+    "'-': Subtracts X by Y\n"
+    "'*': Multiplies X by Y\n"
+    "'/': Divides X by Y (Note: WILL halt if a division by 0 operation is attempted)\n"
+    "-----DATA/MOVEMENT--\n"
+    "'M': Almost 1:1 virtual MOV instruction (Example: 'M 5 A' moves 0101 into register AX)\n"
+    "-----COMPARISON-----\n"
+    "'?': Compares X to Y (Example: '? A B')\n"
+    "'>': X GREATER THAN Y CHECK expression\n"
+    "'<': X LESSER THAN Y CHECK expression\n"
+    "'!': X NOT EQUAL TO Y CHECK expression\n"
+    "-----I/O PORTS------\n"
+    "'I': Reads the next word from input port X into Y (Example: 'I 0 A')\n"
+    "'O': Writes Y to output port X (Example: 'O 0 A')\n"
+    "------CONTROL-------\n"
+    "'@': Prints X value (Example: '@ A' will print the contents of register AX)\n"
+    "'.': Halts immediately\n"
+    "'H': Used to print this IS.\n";
+
+void printUsage(struct VNPU *vm)
+{
+    VnpuPrint(vm, "%s", VnpuUsageText);
+}
+
+void VnpuPrint(struct VNPU *vm, const char *fmt, ...)
+{
+    char small[256];
+    char *buf = small;
+    va_list ap;
+
+    if (!vm->out && !vm->limits.max_output) return;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof small, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+
+    if ((size_t)n >= sizeof small) // only printUsage() gets here
+    {
+        buf = malloc((size_t)n + 1);
+        if (!buf) return;
+        va_start(ap, fmt);
+        vsnprintf(buf, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    if (vm->limits.max_output && vm->out_bytes + (unsigned long long)n > vm->limits.max_output)
+    {
+        vm->HALT = true;
+        vm->HaltReason = VNPU_HALT_OUTPUT_LIMIT;
+        VNPU_PROBE_HALT(vm, vm->HaltReason);
+    }
+    else
+    {
+        vm->out_bytes += (unsigned long long)n;
+        if (vm->out) fwrite(buf, 1, (size_t)n, vm->out);
+        VNPU_PROBE_PRINT(vm, buf, n);
+    }
+
+    if (buf != small) free(buf);
+}
+
+// MACHINE / PROGRAM API
+//
+void VnpuReset(struct VNPU *vm, FILE *out)
+{
+    memset(vm, 0, sizeof *vm);
+    vm->out = out;
+}
+
+void VnpuSharedInit(struct VnpuShared *shared, unsigned cores)
+{
+    for (int i = 0; i < VNPU_SHARED_WORDS; ++i)
+        atomic_init(&shared->mem[i].word, 0);
+    atomic_init(&shared->barrier, (uint64_t)cores << 32);
+    atomic_init(&shared->generation, 0);
+}
+
+void VnpuSharedLeave(struct VnpuShared *shared)
+{
+    uint64_t b = atomic_load(&shared->barrier);
+    uint64_t next;
+    bool open;
+    do
+    {
+        uint64_t running = (b >> 32) - 1, waiting = b & UINT32_MAX;
+        open = waiting > 0 && waiting == running;
+        next = running << 32 | (open ? 0 : waiting);
+    } while (!atomic_compare_exchange_weak(&shared->barrier, &b, next));
+    if (open)
+        atomic_fetch_add(&shared->generation, 1);
+}
+
+static unsigned long long NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ull + (unsigned long long)ts.tv_nsec / 1000000ull;
+}
+
+void VnpuSetLimits(struct VNPU *vm, const struct VnpuLimits *limits)
+{
+    vm->limits = *limits;
+    vm->deadline = limits->max_wall_ms ? NowMs() + limits->max_wall_ms : 0;
+}
+
+int VnpuExitCode(enum VnpuHalt reason)
+{
+    switch (reason)
+    {
+        case VNPU_HALT_ILLEGAL:      return 2;
+        case VNPU_HALT_DIVZERO:      return 2;
+        case VNPU_HALT_INSN_LIMIT:   return 3;
+        case VNPU_HALT_CYCLE_LIMIT:  return 4;
+        case VNPU_HALT_TIME_LIMIT:   return 5;
+        case VNPU_HALT_OUTPUT_LIMIT: return 6;
+        default:                     return 0;
+    }
+}
+
+const char *VnpuHaltName(enum VnpuHalt reason)
+{
+    switch (reason)
+    {
+        case VNPU_RUNNING:           return "running";
+        case VNPU_HALT_INSTR:        return "halted";
+        case VNPU_HALT_ILLEGAL:      return "illegal instruction";
+        case VNPU_HALT_EOF:          return "end of program";
+        case VNPU_HALT_INSN_LIMIT:   return "instruction budget exhausted";
+        case VNPU_HALT_CYCLE_LIMIT:  return "cycle budget exhausted";
+        case VNPU_HALT_TIME_LIMIT:   return "wall time budget exhausted";
+        case VNPU_HALT_OUTPUT_LIMIT: return "output budget exhausted";
+        case VNPU_HALT_IN_CLOSED:    return "input closed";
+        case VNPU_HALT_DIVZERO:      return "division by zero";
+    }
+    return "?";
+}
+
+bool VnpuDecode(char InstrBuff[], struct VnpuOp *op)
+{
+    if (InstrBuff[0] == '\n' || InstrBuff[0] == '\0') return false;
+
+    op->instr = InstrBuff[0];
+    op->com1  = InstrBuff[2];
+    op->com2  = InstrBuff[4];
+    // "X Y Z D": a destination, if there's anything after "X Y Z ". Only if
+    // this line got that far, bytes 5 and 6 may be left from a longer one.
+    op->com3 = '\0';
+    bool reaches = true;
+    for (int i = 1; i <= 4; ++i)
+        reaches = reaches && InstrBuff[i] != '\n' && InstrBuff[i] != '\0';
+    if (reaches && InstrBuff[5] == ' ' && InstrBuff[6] != '\n' && InstrBuff[6] != '\0')
+        op->com3 = InstrBuff[6];
+
+    if (FindInstruction(InstrBuff) == 'e')
+    {
+        op->kind = VNPU_OP_ILLEGAL;
+        return true;
+    }
+
+    /* single-char commands: '.', 'H' */
+    op->kind = VNPU_OP_EXEC;
+    if (InstrBuff[1] == '\n' || InstrBuff[1] == '\0')
+    {
+        if (op->instr == '.')
+            op->kind = VNPU_OP_HALT;
+        else if (op->instr == 'H')
+            op->kind = VNPU_OP_USAGE;
+    }
+    return true;
+}
+
+bool VnpuStep(struct VNPU *vm, const struct VnpuOp *op)
+{
+    switch (op->kind)
+    {
+        case VNPU_OP_HALT:
+            HaltInstruction(vm);
+            return false;
+        case VNPU_OP_USAGE:
+            printUsage(vm);
+            return !vm->HALT;
+        case VNPU_OP_EXEC:
+            if (HandleInstruction(vm, op->instr, op->com1, op->com2, op->com3))
+                return !vm->HALT && !vm->blocked; // '@' can run out of output budget
+            break;
+        default:
+            break;
+    }
+
+    VnpuPrint(vm, "VNPU => ERROR: An illegal instruction was provided.\n");
+    vm->HALT = true;
+    if (vm->HaltReason == VNPU_RUNNING)
+        vm->HaltReason = VNPU_HALT_ILLEGAL;
+    VNPU_PROBE_HALT(vm, vm->HaltReason);
+    return false;
+}
+
+static bool ProgramPush(struct VnpuProgram *prog, const struct VnpuOp *op)
+{
+    if (prog->len == prog->cap)
+    {
+        size_t cap = prog->cap ? prog->cap * 2 : 64;
+        struct VnpuOp *ops = realloc(prog->ops, cap * sizeof *ops);
+        if (!ops) return false;
+        prog->ops = ops;
+        prog->cap = cap;
+    }
+    prog->ops[prog->len++] = *op;
+    return true;
+}
+
+bool VnpuLoad(struct VnpuProgram *prog, const char *text, size_t len)
+{
+    // Kept across chunks on purpose: a short line leaves the tail of the
+    // previous one in here, exactly like InstructionBuffer in the interactive loop.
+    char buf[INSTR_LEN_LIMIT] = {0};
+    int line = 1;
+    size_t i = 0;
+
+    memset(prog, 0, sizeof *prog);
+
+    while (i < len)
+    {
+        int start_line = line;
+        size_t n = 0;
+        while (i < len && n < INSTR_LEN_LIMIT - 1)
+        {
+            buf[n++] = text[i++];
+            if (buf[n - 1] == '\n')
+            {
+                line++;
+                break;
+            }
+        }
+        buf[n] = '\0';
+
+        struct VnpuOp op;
+        if (!VnpuDecode(buf, &op)) continue;
+        op.line = start_line;
+        if (!ProgramPush(prog, &op))
+        {
+            VnpuFree(prog);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VnpuLoadFile(struct VnpuProgram *prog, const char *path)
+{
+    memset(prog, 0, sizeof *prog);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    char *text = NULL;
+    size_t len = 0, cap = 0;
+    for (;;)
+    {
+        if (len == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            char *grown = realloc(text, cap);
+            if (!grown)
+            {
+                free(text);
+                fclose(f);
+                return false;
+            }
+            text = grown;
+        }
+        size_t got = fread(text + len, 1, cap - len, f);
+        len += got;
+        if (got == 0) break;
+    }
+    bool ok = !ferror(f) && VnpuLoad(prog, text, len);
+    fclose(f);
+    free(text);
+    return ok;
+}
+
+void VnpuFree(struct VnpuProgram *prog)
+{
+    free(prog->ops);
+    memset(prog, 0, sizeof *prog);
+}
+
+unsigned VnpuOpCycles(const struct VnpuOp *op)
+{
+    if (op->kind != VNPU_OP_EXEC) return 0;
+    switch (op->instr)
+    {
+        case '+': case '-': case '*':
+        case '/': case 'M':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// CheckBudgets ( struct VNPU *vm, const struct VnpuProgram *prog, size_t *block )
+// ⤷ Called on block entry. Halts the machine if a budget is already spent,
+//   otherwise clips the block so that it can't overrun the instruction or
+//   cycle budget ( every op ticks at most once ), which means nothing has to
+//   be checked inside the block itself.
+static bool CheckBudgets(struct VNPU *vm, const struct VnpuProgram *prog, size_t *block)
+{
+    const struct VnpuLimits *lim = &vm->limits;
+
+    if (lim->max_insns)
+    {
+        if (vm->insns >= lim->max_insns)
+        {
+            vm->HaltReason = VNPU_HALT_INSN_LIMIT;
+            return false;
+        }
+        if (lim->max_insns - vm->insns < *block)
+            *block = (size_t)(lim->max_insns - vm->insns);
+    }
+    if (lim->max_cycles)
+    {
+        if (vm->cycles >= lim->max_cycles)
+        {
+            // out of cycles, but ops that don't tick may still go one by one
+            if (VnpuOpCycles(&prog->ops[vm->pc]) > 0)
+            {
+                vm->HaltReason = VNPU_HALT_CYCLE_LIMIT;
+                return false;
+            }
+            *block = 1;
+        }
+        else if (lim->max_cycles - vm->cycles < *block)
+            *block = (size_t)(lim->max_cycles - vm->cycles);
+    }
+    if (vm->deadline && NowMs() >= vm->deadline)
+    {
+        vm->HaltReason = VNPU_HALT_TIME_LIMIT;
+        return false;
+    }
+    return true;
+}
+
+enum VnpuHalt VnpuRun(struct VNPU *vm, const struct VnpuProgram *prog)
+{
+    struct VnpuProfile *prof = vm->prof;
+
+    while (!vm->HALT)
+    {
+        if (vm->pc >= prog->len)
+        {
+            vm->HaltReason = VNPU_HALT_EOF;
+            VNPU_PROBE_HALT(vm, vm->HaltReason);
+            break;
+        }
+
+        // a throttled machine takes 337 ms per op, so look at the clock every op
+        size_t block = vm->throttle ? 1 : VNPU_BLOCK_LEN;
+        if (block > prog->len - vm->pc)
+            block = prog->len - vm->pc;
+        if (!CheckBudgets(vm, prog, &block))
+        {
+            vm->HALT = true;
+            VNPU_PROBE_HALT(vm, vm->HaltReason);
+            break;
+        }
+
+        VNPU_PROBE_BLOCK(vm, vm->pc, block);
+        size_t end = vm->pc + block;
+        size_t start = vm->pc;
+        if (prof)
+        {
+            while (vm->pc < end)
+            {
+                size_t pc = vm->pc++;
+                unsigned long long before = vm->cycles;
+                bool more = VnpuStep(vm, &prog->ops[pc]);
+                if (vm->blocked) break;
+                prof->insns[pc]++;
+                prof->cycles[pc] += vm->cycles - before;
+                if (!more) break;
+            }
+        }
+        else
+        {
+            while (vm->pc < end && VnpuStep(vm, &prog->ops[vm->pc++]))
+                ;
+        }
+
+        if (vm->blocked)
+        {
+            // it never happened: run it again next time
+            vm->blocked = false;
+            vm->pc--;
+            vm->insns += vm->pc - start;
+            return VNPU_RUNNING;
+        }
+        vm->insns += vm->pc - start;
+    }
+    return vm->HaltReason;
+}
+
+bool VnpuProfileInit(struct VnpuProfile *prof, const struct VnpuProgram *prog)
+{
+    size_t n = prog->len ? prog->len : 1;
+    prof->insns  = calloc(n, sizeof *prof->insns);
+    prof->cycles = calloc(n, sizeof *prof->cycles);
+    prof->len    = prog->len;
+    if (!prof->insns || !prof->cycles)
+    {
+        VnpuProfileFree(prof);
+        return false;
+    }
+    return true;
+}
+
+void VnpuProfileFree(struct VnpuProfile *prof)
+{
+    free(prof->insns);
+    free(prof->cycles);
+    memset(prof, 0, sizeof *prof);
+}
+
+void VnpuFormatOp(const struct VnpuOp *op, char buf[8])
+{
+    char c[4] = { op->instr, op->com1, op->com2, op->com3 };
+    int n = op->com3 && strchr("+-*/", op->instr) ? 4 : 3; // nothing else looks at com3
+
+    if (op->kind == VNPU_OP_HALT || op->kind == VNPU_OP_USAGE)
+        n = 1;
+    // a short line ends in '\n' / '\0' where its operands would be
+    while (n > 1 && (c[n - 1] == '\n' || c[n - 1] == '\0'))
+        n--;
+
+    int k = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (i > 0) buf[k++] = ' ';
+        buf[k++] = isgraph((unsigned char)c[i]) ? c[i] : '?';
+    }
+    buf[k] = '\0';
+}
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "../vnpu.h"
+
+/*
+	fuzz_frontend
+	- libFuzzer entry point for the interactive front end ( vnpu.c ):
+	  every input is typed at the '> ' prompt, through the very same
+	  FrontEndStep() main() uses ( fgets() into the 9-byte
+	  InstructionBuffer, VnpuDecode(), VnpuStep() ), on vnpu.c's own VM.
+	- Persistent: VM is reset in-process between inputs, nothing is
+	  exec'd and nothing sleeps ( the 337 ms clock is off ). Prints are
+	  still formatted and counted, just not written anywhere.
+	- The same bytes are then loaded with VnpuLoad() and run with
+	  VnpuRun() on a second machine; ending up anywhere else than the
+	  front end did is a crash too.
+	- The first word of the input also goes through ParseExitAnswer(),
+	  the way SigIntHandler() would have read it.
+	- vnpu.c is built with -DFUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION,
+	  which leaves its main() out. Add -DVNPU_FUZZ_MAIN for a main() of
+	  our own on hosts without libFuzzer: it replays files and
+	  directories, and with -n mutates them ( blindly, no coverage ).
+*/
+
+// Longer inputs are just more of the same lines
+#define MAX_INPUT 4096
+
+// In vnpu.c
+extern struct VNPU VM;
+bool FrontEndStep(struct VNPU *vm, FILE *in);
+int ParseExitAnswer(const char *ret);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Same ( const struct VNPU *a, const struct VNPU *b )
+// ⤷ Whether two machines ended up in the same architectural state
+static bool Same(const struct VNPU *a, const struct VNPU *b)
+{
+    return memcmp(a->R, b->R, sizeof a->R) == 0
+        && memcmp(a->MEM, b->MEM, sizeof a->MEM) == 0
+        && a->cycles == b->cycles
+        && a->out_bytes == b->out_bytes;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0 || size > MAX_INPUT) return 0;
+
+    // count what gets printed instead of writing it out
+    struct VnpuLimits limits = { 0, 0, 0, ~0ull };
+
+    FILE *in = fmemopen((void *)data, size, "r");
+    if (!in) return 0;
+    VnpuReset(&VM, NULL);
+    VnpuSetLimits(&VM, &limits);
+    while (FrontEndStep(&VM, in))
+        ;
+    fclose(in);
+    enum VnpuHalt front = VM.HALT ? VM.HaltReason : VNPU_HALT_EOF;
+
+    struct VnpuProgram prog;
+    struct VNPU vm;
+    if (!VnpuLoad(&prog, (const char *)data, size)) return 0;
+    VnpuReset(&vm, NULL);
+    VnpuSetLimits(&vm, &limits);
+    enum VnpuHalt loaded = VnpuRun(&vm, &prog);
+    VnpuFree(&prog);
+    if (loaded != front || !Same(&VM, &vm))
+        abort();
+
+    char ret[8];
+    size_t i = 0, n = 0;
+    while (i < size && isspace(data[i])) i++;
+    while (i < size && n < 7 && data[i] && !isspace(data[i])) ret[n++] = (char)data[i++];
+    ret[n] = '\0';
+    if (n > 0 && ParseExitAnswer(ret) > 1)
+        abort();
+    return 0;
+}
+
+#ifdef VNPU_FUZZ_MAIN
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+
+struct Input
+{
+    uint8_t *data;
+    size_t len;
+};
+
+struct Input *Corpus;
+size_t CorpusLen, CorpusCap;
+struct Input *Dict;
+size_t DictLen, DictCap;
+
+uint8_t Current[MAX_INPUT];
+size_t CurrentLen;
+const char *CrashPath = "crash.vnis";
+
+void printFuzzUsage(void);
+
+static bool Push(struct Input **list, size_t *len, size_t *cap, const uint8_t *data, size_t n)
+{
+    if (*len == *cap)
+    {
+        size_t grown = *cap ? *cap * 2 : 64;
+        struct Input *l = realloc(*list, grown * sizeof *l);
+        if (!l) return false;
+        *list = l;
+        *cap = grown;
+    }
+    uint8_t *copy = malloc(n ? n : 1);
+    if (!copy) return false;
+    memcpy(copy, data, n);
+    (*list)[(*len)++] = (struct Input){ copy, n };
+    return true;
+}
+
+// AddFile ( const char *path )
+// ⤷ One corpus file, or every file in a directory
+static bool AddFile(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir)
+    {
+        struct dirent *e;
+        bool ok = true;
+        while (ok && (e = readdir(dir)))
+        {
+            if (e->d_name[0] == '.') continue;
+            size_t n = strlen(path) + strlen(e->d_name) + 2;
+            char *sub = malloc(n);
+            if (!sub) break;
+            snprintf(sub, n, "%s/%s", path, e->d_name);
+            ok = AddFile(sub);
+            free(sub);
+        }
+        closedir(dir);
+        return ok;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot read \"%s\".\n", path);
+        return false;
+    }
+    size_t n = fread(Current, 1, MAX_INPUT, f);
+    fclose(f);
+    return Push(&Corpus, &CorpusLen, &CorpusCap, Current, n);
+}
+
+// LoadDict ( const char *path )
+// ⤷ A libFuzzer / AFL dictionary: one name="value" per line, with \\, \" and \xNN
+static bool LoadDict(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot read \"%s\".\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof line, f))
+    {
+        char *q = strchr(line, '"');
+        if (line[0] == '#' || !q) continue;
+
+        uint8_t value[256];
+        size_t n = 0;
+        for (char *c = q + 1; *c && *c != '"'; ++c)
+        {
+            if (*c == '\\' && c[1] == 'x' && isxdigit((unsigned char)c[2]) && isxdigit((unsigned char)c[3]))
+            {
+                char hex[3] = { c[2], c[3], '\0' };
+                value[n++] = (uint8_t)strtol(hex, NULL, 16);
+                c += 3;
+            }
+            else if (*c == '\\' && c[1])
+                value[n++] = (uint8_t)*++c;
+            else
+                value[n++] = (uint8_t)*c;
+        }
+        if (n > 0 && !Push(&Dict, &DictLen, &DictCap, value, n))
+            break;
+    }
+    fclose(f);
+    return true;
+}
+
+static uint64_t Rng;
+
+static uint64_t Next(void) // splitmix64
+{
+    uint64_t z = (Rng += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Mutate ( void )
+// ⤷ A few random edits to Current: bytes from the v'NIS alphabet, dictionary
+//   words, bit flips, cut or repeated stretches
+static void Mutate(void)
+{
+    static const char alphabet[] = "+-*/M?<>!IO@.HLSXCFW#AB0123456789 \n";
+    int edits = 1 + (int)(Next() % 4);
+
+    for (int e = 0; e < edits; ++e)
+    {
+        size_t at = CurrentLen ? Next() % (CurrentLen + 1) : 0;
+        switch (Next() % 6)
+        {
+            case 0: // overwrite a byte
+                if (at < CurrentLen)
+                    Current[at] = (uint8_t)alphabet[Next() % (sizeof alphabet - 1)];
+                break;
+            case 1: // flip a bit
+                if (at < CurrentLen)
+                    Current[at] ^= (uint8_t)(1u << (Next() % 8));
+                break;
+            case 2: // insert a dictionary word, or a byte
+            {
+                uint8_t byte = (uint8_t)alphabet[Next() % (sizeof alphabet - 1)];
+                const uint8_t *word = &byte;
+                size_t n = 1;
+                if (DictLen)
+                {
+                    const struct Input *d = &Dict[Next() % DictLen];
+                    word = d->data;
+                    n = d->len;
+                }
+                if (CurrentLen + n > MAX_INPUT) break;
+                memmove(Current + at + n, Current + at, CurrentLen - at);
+                memcpy(Current + at, word, n);
+                CurrentLen += n;
+                break;
+            }
+            case 3: // cut a stretch
+            {
+                size_t n = at < CurrentLen ? 1 + Next() % (CurrentLen - at) % 8 : 0;
+                memmove(Current + at, Current + at + n, CurrentLen - at - n);
+                CurrentLen -= n;
+                break;
+            }
+            case 4: // repeat a stretch
+            {
+                size_t n = at < CurrentLen ? 1 + Next() % (CurrentLen - at) % 16 : 0;
+                if (CurrentLen + n > MAX_INPUT) break;
+                memmove(Current + at + n, Current + at, CurrentLen - at);
+                CurrentLen += n;
+                break;
+            }
+            default: // splice in another input's tail
+            {
+                const struct Input *o = &Corpus[Next() % CorpusLen];
+                size_t from = o->len ? Next() % o->len : 0;
+                size_t n = o->len - from;
+                if (at + n > MAX_INPUT) n = MAX_INPUT - at;
+                memcpy(Current + at, o->data + from, n);
+                CurrentLen = at + n;
+                break;
+            }
+        }
+    }
+}
+
+// SaveCrash ( void )
+// ⤷ Writes the input that is running to CrashPath. Called from signal
+//   handlers and sanitizer reports, so only write() and friends.
+static void SaveCrash(void)
+{
+    int fd = open(CrashPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    ssize_t unused = write(fd, Current, CurrentLen);
+    (void)unused;
+    close(fd);
+    static const char note[] = "VNPU => CRASH: the input is in the crash file ( -o ).\n";
+    unused = write(STDERR_FILENO, note, sizeof note - 1);
+}
+
+static void CrashHandler(int sig)
+{
+    SaveCrash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// set when built with a sanitizer, which reports and exits on its own
+extern void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void printFuzzUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: fuzz_frontend [-n RUNS] [-s SEED] [-x DICT] [-o CRASH] CORPUS...\n"
+        "  -n RUNS   mutated inputs to try after replaying CORPUS ( default: 0 )\n"
+        "  -s SEED   seed for the mutations ( default: 1 )\n"
+        "  -x DICT   dictionary to draw words from, like fuzz/vnis.dict\n"
+        "  -o CRASH  where the input that crashed goes ( default: crash.vnis )\n"
+        "CORPUS is any number of files and directories of inputs.\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long runs = 0;
+    int opt;
+
+    Rng = 1;
+    while ((opt = getopt(argc, argv, "n:s:x:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                runs = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                Rng = strtoull(optarg, NULL, 10);
+                break;
+            case 'x':
+                if (!LoadDict(optarg)) return 1;
+                break;
+            case 'o':
+                CrashPath = optarg;
+                break;
+            default:
+                printFuzzUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc)
+    {
+        printFuzzUsage();
+        return 1;
+    }
+    for (int i = optind; i < argc; ++i)
+        if (!AddFile(argv[i])) return 1;
+    if (CorpusLen == 0)
+    {
+        fprintf(stderr, "VNPU => ERROR: the corpus is empty.\n");
+        return 1;
+    }
+
+    signal(SIGSEGV, CrashHandler);
+    signal(SIGABRT, CrashHandler);
+    signal(SIGFPE, CrashHandler);
+    signal(SIGBUS, CrashHandler);
+    signal(SIGILL, CrashHandler);
+    if (__sanitizer_set_death_callback)
+        __sanitizer_set_death_callback(SaveCrash);
+
+    double start = NowSec();
+    for (size_t i = 0; i < CorpusLen; ++i)
+    {
+        memcpy(Current, Corpus[i].data, Corpus[i].len);
+        CurrentLen = Corpus[i].len;
+        LLVMFuzzerTestOneInput(Current, CurrentLen);
+    }
+    for (unsigned long long r = 0; r < runs; ++r)
+    {
+        const struct Input *base = &Corpus[Next() % CorpusLen];
+        memcpy(Current, base->data, base->len);
+        CurrentLen = base->len;
+        Mutate();
+        LLVMFuzzerTestOneInput(Current, CurrentLen);
+    }
+    double elapsed = NowSec() - start;
+
+    unsigned long long total = CorpusLen + runs;
+    printf("VNPU => %llu inputs in %.3f s ( %.0f execs/s ), no crashes.\n",
+           total, elapsed, elapsed > 0 ? (double)total / elapsed : 0.0);
+
+    for (size_t i = 0; i < CorpusLen; ++i)
+        free(Corpus[i].data);
+    for (size_t i = 0; i < DictLen; ++i)
+        free(Dict[i].data);
+    free(Corpus);
+    free(Dict);
+    return 0;
+}
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ports.h"
+
+static inline void CpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+void PortBackoff(unsigned *spins)
+{
+    unsigned n = (*spins)++;
+    if (n < 64)
+        CpuRelax();
+    else if (n < 128)
+        sched_yield();
+    else
+    {
+        struct timespec nap = { 0, 50000 }; // 50 us
+        nanosleep(&nap, NULL);
+    }
+}
+
+struct VnpuShm *VnpuShmCreate(const char *name)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+
+    if (ftruncate(fd, sizeof(struct VnpuShm)) < 0)
+    {
+        int err = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = err;
+        return NULL;
+    }
+
+    struct VnpuShm *shm = mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        int err = errno;
+        shm_unlink(name);
+        errno = err;
+        return NULL;
+    }
+
+    // ftruncate() hands out zeroes, only the atomics and the header need setting
+    for (int i = 0; i < VNPU_PORT_COUNT; ++i)
+    {
+        atomic_init(&shm->in[i].head, 0);
+        atomic_init(&shm->in[i].tail, 0);
+        atomic_init(&shm->in[i].closed, 0);
+        atomic_init(&shm->out[i].head, 0);
+        atomic_init(&shm->out[i].tail, 0);
+        atomic_init(&shm->out[i].closed, 0);
+    }
+    shm->ports = VNPU_PORT_COUNT;
+    shm->slots = VNPU_RING_SLOTS;
+    shm->version = VNPU_SHM_VERSION;
+    atomic_thread_fence(memory_order_release);
+    shm->magic = VNPU_SHM_MAGIC;
+    return shm;
+}
+
+struct VnpuShm *VnpuShmAttach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct VnpuShm))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct VnpuShm *shm = mmap(NULL, sizeof *shm, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) return NULL;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (shm->magic != VNPU_SHM_MAGIC || shm->version != VNPU_SHM_VERSION
+        || shm->ports != VNPU_PORT_COUNT || shm->slots != VNPU_RING_SLOTS)
+    {
+        munmap(shm, sizeof *shm);
+        errno = EINVAL;
+        return NULL;
+    }
+    return shm;
+}
+
+void VnpuShmDetach(struct VnpuShm *shm)
+{
+    if (shm) munmap(shm, sizeof *shm);
+}
+
+// ShmIn / ShmOut ( void *ctx, int port, ... )
+// ⤷ struct VnpuPortOps for a VNPU attached to shared memory: wait a little
+//   for the ring to have something ( or room ), then report VNPU_PORT_BLOCKED
+//   so that VnpuRun() backs out and the caller gets to look at its budgets
+#define SHM_SPIN_LIMIT 128 // pauses, then yields, never naps
+
+static int ShmIn(void *ctx, int port, uint64_t *val)
+{
+    struct VnpuShmPorts *p = ctx;
+    unsigned spins = 0;
+    int status;
+    while ((status = RingTryPop(&p->in[port], val)) == VNPU_PORT_BLOCKED && spins < SHM_SPIN_LIMIT)
+        PortBackoff(&spins);
+    return status;
+}
+
+static int ShmOut(void *ctx, int port, uint64_t val)
+{
+    struct VnpuShmPorts *p = ctx;
+    unsigned spins = 0;
+    int status;
+    while ((status = RingTryPush(&p->out[port], val)) == VNPU_PORT_BLOCKED && spins < SHM_SPIN_LIMIT)
+        PortBackoff(&spins);
+    return status;
+}
+
+void VnpuShmBind(struct VnpuShmPorts *p, struct VnpuShm *shm, struct VnpuPortOps *ops)
+{
+    p->shm = shm;
+    for (int i = 0; i < VNPU_PORT_COUNT; ++i)
+    {
+        RingEndInit(&p->in[i], &shm->in[i], false);
+        RingEndInit(&p->out[i], &shm->out[i], true);
+    }
+    ops->In = ShmIn;
+    ops->Out = ShmOut;
+    ops->ctx = p;
+    ops->print_out = false;
+}
+
+void VnpuShmRelease(struct VnpuShmPorts *p)
+{
+    for (int i = 0; i < VNPU_PORT_COUNT; ++i)
+        RingClose(&p->out[i]);
+}
@@ -0,0 +1,151 @@
+#ifndef VNPU_PORTS_H
+#define VNPU_PORTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "vnpu.h"
+
+/*
+	Shared-memory I/O ports
+	- One POSIX shared-memory object holds VNPU_PORT_COUNT input and
+	  VNPU_PORT_COUNT output rings. Every ring is single-producer /
+	  single-consumer and lock-free: the producer only ever writes 'tail',
+	  the consumer only ever writes 'head'.
+	- Input rings are filled by the host and drained by 'I p R', output
+	  rings are filled by 'O p X' and drained by the host. Values are
+	  native 64-bit words, no text anywhere.
+	- A producer that is done sets 'closed'; a consumer that finds its
+	  ring empty and closed has seen the last value.
+	- The host creates the object ( VnpuShmCreate() ), the VNPU attaches
+	  to it ( VnpuShmAttach() ). Both sides cache the other side's index
+	  so they only touch the shared one when they run out.
+*/
+
+// VNPU_RING_SLOTS must be a power of two
+#define VNPU_RING_SLOTS (1u << 16)
+#define VNPU_SHM_MAGIC 0x55504e56u // "VNPU"
+#define VNPU_SHM_VERSION 1u
+
+struct VnpuRing
+{
+    _Alignas(64) atomic_uint_fast64_t head; // next slot to read, written by the consumer
+    _Alignas(64) atomic_uint_fast64_t tail; // next slot to write, written by the producer
+    _Alignas(64) atomic_uint closed;        // set by the producer when it's done
+    _Alignas(64) uint64_t slots[VNPU_RING_SLOTS];
+};
+
+struct VnpuShm
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ports;
+    uint32_t slots;
+    struct VnpuRing in[VNPU_PORT_COUNT];  // host -> VNPU
+    struct VnpuRing out[VNPU_PORT_COUNT]; // VNPU -> host
+};
+
+// One side's view of one ring
+struct VnpuRingEnd
+{
+    struct VnpuRing *ring;
+    uint64_t pos;    // our own index
+    uint64_t cached; // last seen value of the other side's index
+};
+
+// The VNPU side of a mapped object, plugged into a machine as its struct VnpuPortOps.
+// Its In / Out spin ( PortBackoff() ) for a while, then report VNPU_PORT_BLOCKED:
+// run it with VnpuRun() in a loop, like vnpu-run -P does.
+struct VnpuShmPorts
+{
+    struct VnpuShm *shm;
+    struct VnpuRingEnd in[VNPU_PORT_COUNT];
+    struct VnpuRingEnd out[VNPU_PORT_COUNT];
+};
+
+// RingEndInit ( struct VnpuRingEnd *end, struct VnpuRing *ring, bool producer )
+static inline void RingEndInit(struct VnpuRingEnd *end, struct VnpuRing *ring, bool producer)
+{
+    end->ring = ring;
+    if (producer)
+    {
+        end->pos    = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        end->cached = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    else
+    {
+        end->pos    = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        end->cached = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+}
+
+// RingTryPush ( struct VnpuRingEnd *end, uint64_t val )
+// ⤷ Producer side. VNPU_PORT_OK or VNPU_PORT_BLOCKED if the ring is full.
+static inline int RingTryPush(struct VnpuRingEnd *end, uint64_t val)
+{
+    struct VnpuRing *r = end->ring;
+    if (end->pos - end->cached >= VNPU_RING_SLOTS)
+    {
+        end->cached = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (end->pos - end->cached >= VNPU_RING_SLOTS)
+            return VNPU_PORT_BLOCKED;
+    }
+    r->slots[end->pos & (VNPU_RING_SLOTS - 1)] = val;
+    atomic_store_explicit(&r->tail, ++end->pos, memory_order_release);
+    return VNPU_PORT_OK;
+}
+
+// RingTryPop ( struct VnpuRingEnd *end, uint64_t *val )
+// ⤷ Consumer side. VNPU_PORT_OK, VNPU_PORT_BLOCKED if the ring is empty,
+//   VNPU_PORT_CLOSED if it is empty for good.
+static inline int RingTryPop(struct VnpuRingEnd *end, uint64_t *val)
+{
+    struct VnpuRing *r = end->ring;
+    if (end->pos == end->cached)
+    {
+        end->cached = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (end->pos == end->cached)
+        {
+            if (!atomic_load_explicit(&r->closed, memory_order_acquire))
+                return VNPU_PORT_BLOCKED;
+            // the producer may have pushed right before closing
+            end->cached = atomic_load_explicit(&r->tail, memory_order_acquire);
+            if (end->pos == end->cached)
+                return VNPU_PORT_CLOSED;
+        }
+    }
+    *val = r->slots[end->pos & (VNPU_RING_SLOTS - 1)];
+    atomic_store_explicit(&r->head, ++end->pos, memory_order_release);
+    return VNPU_PORT_OK;
+}
+
+// RingClose ( struct VnpuRingEnd *end )
+// ⤷ Producer side: no more values will come
+static inline void RingClose(struct VnpuRingEnd *end)
+{
+    atomic_store_explicit(&end->ring->closed, 1, memory_order_release);
+}
+
+// PortBackoff ( unsigned *spins )
+// ⤷ What to do while a ring is empty / full: spin a little, then yield, then nap
+void PortBackoff(unsigned *spins);
+
+// VnpuShmCreate ( const char *name ) / VnpuShmAttach ( const char *name )
+// ⤷ Creates and initializes ( host ) or maps an existing ( VNPU ) shared-memory
+//   object, NULL on error with errno set. VnpuShmCreate() fails if 'name' exists.
+struct VnpuShm *VnpuShmCreate(const char *name);
+struct VnpuShm *VnpuShmAttach(const char *name);
+
+// VnpuShmDetach ( struct VnpuShm *shm )
+void VnpuShmDetach(struct VnpuShm *shm);
+
+// VnpuShmBind ( struct VnpuShmPorts *p, struct VnpuShm *shm, struct VnpuPortOps *ops )
+// ⤷ Makes 'ops' serve 'I' / 'O' from 'shm'
+void VnpuShmBind(struct VnpuShmPorts *p, struct VnpuShm *shm, struct VnpuPortOps *ops);
+
+// VnpuShmRelease ( struct VnpuShmPorts *p )
+// ⤷ Closes every output ring, for when the machine has halted
+void VnpuShmRelease(struct VnpuShmPorts *p);
+
+#endif
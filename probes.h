@@ -0,0 +1,48 @@
+#ifndef VNPU_PROBES_H
+#define VNPU_PROBES_H
+
+/*
+	USDT probes
+	- Build with -DVNPU_USDT on a system that has <sys/sdt.h> ( systemtap-sdt-dev,
+	  systemtap-sdt-devel ) and every probe below becomes a single nop plus a
+	  note in the binary that perf, bpftrace, stap and friends can hook:
+	      bpftrace -e 'usdt:./vnpu-run:vnpu:insn { @[arg1] = count(); }'
+	  Without either, they compile to nothing.
+	- Every probe takes the machine first ( arg0 ) so that machines sharing
+	  a process ( vnpu-run ) can be told apart.
+
+	vnpu:insn  ( vm, instr, com1, com2 )  an op is about to be dispatched
+	vnpu:reg   ( vm, reg, value )         'A', 'B' or 'M' ( MEM ) written, low 64 bits
+	vnpu:in    ( vm, port, value )        'I' read a word
+	vnpu:out   ( vm, port, value )        'O' wrote a word
+	vnpu:print ( vm, text, len )          bytes printed ( not NUL-terminated )
+	vnpu:halt  ( vm, reason )             the machine halted, an enum VnpuHalt
+	vnpu:block ( vm, pc, len )            VnpuRun() is about to run ops pc .. pc+len-1
+*/
+
+#if defined(VNPU_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VNPU_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef VNPU_PROBES_ENABLED
+#define VNPU_PROBE_INSN(vm, instr, com1, com2) DTRACE_PROBE4(vnpu, insn, vm, (int)(instr), (int)(com1), (int)(com2))
+#define VNPU_PROBE_REG(vm, which, value)       DTRACE_PROBE3(vnpu, reg, vm, (int)(which), (uint64_t)(value))
+#define VNPU_PROBE_IN(vm, port, value)         DTRACE_PROBE3(vnpu, in, vm, (int)(port), (uint64_t)(value))
+#define VNPU_PROBE_OUT(vm, port, value)        DTRACE_PROBE3(vnpu, out, vm, (int)(port), (uint64_t)(value))
+#define VNPU_PROBE_PRINT(vm, text, len)        DTRACE_PROBE3(vnpu, print, vm, text, (size_t)(len))
+#define VNPU_PROBE_HALT(vm, reason)            DTRACE_PROBE2(vnpu, halt, vm, (int)(reason))
+#define VNPU_PROBE_BLOCK(vm, pc, len)          DTRACE_PROBE3(vnpu, block, vm, (size_t)(pc), (size_t)(len))
+#else
+#define VNPU_PROBE_INSN(vm, instr, com1, com2) ((void)0)
+#define VNPU_PROBE_REG(vm, which, value)       ((void)0)
+#define VNPU_PROBE_IN(vm, port, value)         ((void)0)
+#define VNPU_PROBE_OUT(vm, port, value)        ((void)0)
+#define VNPU_PROBE_PRINT(vm, text, len)        ((void)0)
+#define VNPU_PROBE_HALT(vm, reason)            ((void)0)
+#define VNPU_PROBE_BLOCK(vm, pc, len)          ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <sys/wait.h>
+
+#include "vnpu.h"
+
+/*
+	vnpu-aot
+	- Translates a v'NIS program into one standalone C file. The register
+	  file becomes locals of main(), every op becomes a line of straight
+	  C, so the C compiler gets to optimize the whole program at once.
+	- Operands are plain characters, so most of what HandleInstruction()
+	  decides at run time ( illegal operands, comparisons, what '@'
+	  prints ) is decided here instead; only division by zero is left
+	  for run time.
+	- The translated binary prints byte for byte what vnpu-run prints for
+	  the same program and exits with the same code ( VnpuExitCode() ).
+	  --verify compiles it with $CC ( or cc ) and checks exactly that.
+	- Only words up to 32 bits: a double-width result has to fit a uint64_t.
+	- The translated program has no I/O ports attached, like vnpu-run
+	  without -P: the first valid 'I' halts it ( input closed ) and 'O'
+	  writes nowhere.
+	- --trace makes it also print the registers after every op that
+	  doesn't halt, as "\001AX BX .. MEM[0] MEM[1]" lines ( all
+	  VNPU_REGS of them ) in between its output, for vnpu-diff.
+*/
+
+// Emit ( FILE *f, const struct VnpuProgram *prog, const char *name, bool trace )
+// ⤷ Writes the translation of 'prog' to 'f', with a TRACE() after every op if 'trace'
+void Emit(FILE *f, const struct VnpuProgram *prog, const char *name, bool trace);
+
+// EmitString ( FILE *f, const char *s, size_t len )
+// ⤷ Writes 's' as a C string literal, escaping everything that isn't plain ASCII
+void EmitString(FILE *f, const char *s, size_t len);
+
+// Verify ( const struct VnpuProgram *prog, const char *name )
+// ⤷ Translates, compiles and runs 'prog', then runs it on the interpreter and
+//   compares output and exit code. Returns true if they match.
+bool Verify(const struct VnpuProgram *prog, const char *name);
+
+void printAotUsage(void);
+
+void EmitString(FILE *f, const char *s, size_t len)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '\n')
+            fputs("\\n\"\n    \"", f);
+        else if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (isprint(c) && c != '?') // '?' could start a trigraph
+            fputc(c, f);
+        else
+            fprintf(f, "\\%03o", c);
+    }
+    fputc('"', f);
+}
+
+// Operand ( char c, char expr[16] )
+// ⤷ The C expression ResolveOperand() would have produced for 'c', false if illegal
+static bool Operand(char c, char expr[16])
+{
+    if (isdigit((unsigned char)c))
+        snprintf(expr, 16, "(%d & WMASK)", c - '0');
+    else if (RegisterIndex(c) >= 0)
+        snprintf(expr, 16, "%cX", c);
+    else
+        return false;
+    return true;
+}
+
+// EmitExec ( FILE *f, const struct VnpuOp *op )
+// ⤷ One HandleInstruction() call. Returns false if the op always halts.
+static bool EmitExec(FILE *f, const struct VnpuOp *op)
+{
+    char x[16], y[16];
+
+    switch (op->instr)
+    {
+        case '+': case '-': case '*': case '/':
+        {
+            char dst = op->com3 ? op->com3 : 'A';
+            if (!Operand(op->com1, x) || !Operand(op->com2, y))
+                break;
+            if (op->instr == '/')
+            {
+                // a digit is masked to the word size, which can make it 0
+                if (isdigit((unsigned char)op->com2)
+                    && ((uint64_t)(op->com2 - '0') & ((UINT64_C(1) << VNPU_WORD_SIZE) - 1)) == 0)
+                    break;
+                if (!isdigit((unsigned char)op->com2))
+                    fprintf(f, "if (%s == 0) return Illegal(); ", y);
+            }
+            if (RegisterIndex(dst) < 0)
+                break;
+            fprintf(f, "RESULT(%cX, %s %c %s);\n", dst, x, op->instr, y);
+            return true;
+        }
+
+        case 'M':
+            if (RegisterIndex(op->com2) < 0 || op->com1 == op->com2 || !Operand(op->com1, x))
+                break;
+            fprintf(f, "%cX = %s;\n", op->com2, x);
+            return true;
+
+        // the comparisons only look at the characters, so they're known now
+        case '?':
+            if (CmpInstruction(op->com1, op->com2)) break;
+            fprintf(f, "/* false */\n");
+            return true;
+        case '>':
+            if (GrThInstruction(op->com1, op->com2)) break;
+            fprintf(f, "/* false */\n");
+            return true;
+        case '<':
+            if (LsThInstruction(op->com1, op->com2)) break;
+            fprintf(f, "/* false */\n");
+            return true;
+        case '!':
+            if (NotEqInstruction(op->com1, op->com2)) break;
+            fprintf(f, "/* false */\n");
+            return true;
+
+        case '@':
+            if (RegisterIndex(op->com1) >= 0)
+                fprintf(f, "PrintWord(%cX);\n", op->com1);
+            else
+            {
+                char text[2] = { op->com1, '\n' };
+                fprintf(f, "fwrite(");
+                EmitString(f, text, 2);
+                fprintf(f, ", 1, 2, stdout);\n");
+            }
+            return true;
+
+        case 'H':
+            fprintf(f, "fputs(Usage, stdout);\n");
+            return true;
+
+        // no ports attached ( see InInstruction() / OutInstruction() )
+        case 'I':
+            if (op->com1 < '0' || op->com1 >= '0' + VNPU_PORT_COUNT) break;
+            if (RegisterIndex(op->com2) < 0) break;
+            fprintf(f, "return %d;\n", VnpuExitCode(VNPU_HALT_IN_CLOSED));
+            return false;
+        case 'O':
+            if (op->com1 < '0' || op->com1 >= '0' + VNPU_PORT_COUNT) break;
+            if (!Operand(op->com2, y)) break;
+            fprintf(f, "/* nowhere */\n");
+            return true;
+
+        default:
+            break;
+    }
+
+    fprintf(f, "return Illegal();\n");
+    return false;
+}
+
+void Emit(FILE *f, const struct VnpuProgram *prog, const char *name, bool trace)
+{
+    fprintf(f, "/* Translated from %s by vnpu-aot ( VNPU_WORD_SIZE %d ). Do not edit. */\n",
+            name, VNPU_WORD_SIZE);
+    fprintf
+    (
+        f,
+        "#include <stdio.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#define W %d\n"
+        "#define WMASK ((UINT64_C(1) << W) - 1)\n"
+        "\n"
+        "// Every result is computed at double width, the low word goes to AX ( or\n"
+        "// 'd' ) and MEM[1], the high one to MEM[0], like dec2bin2reg()/dec2bin2mem()\n"
+        "#define RESULT(d, x) do { uint64_t r_ = (x); d = r_ & WMASK; \\\n"
+        "    MEM[1] = r_ & WMASK; MEM[0] = (r_ >> W) & WMASK; } while (0)\n"
+        "\n"
+        "static void PrintWord(uint64_t v)\n"
+        "{\n"
+        "    printf(\"%%llu\\n\", (unsigned long long)v);\n"
+        "}\n"
+        "\n"
+        "static int Illegal(void)\n"
+        "{\n"
+        "    fputs(\"VNPU => ERROR: An illegal instruction was provided.\\n\", stdout);\n"
+        "    return %d;\n"
+        "}\n"
+        "\n",
+        VNPU_WORD_SIZE, VnpuExitCode(VNPU_HALT_ILLEGAL)
+    );
+
+    fprintf(f, "#define TRACE() printf(\"\\001");
+    for (int r = 0; r < VNPU_REGS; ++r)
+        fprintf(f, "%%llu ");
+    fprintf(f, "%%llu %%llu\\n\"");
+    for (int r = 0; r < VNPU_REGS; ++r)
+        fprintf(f, ", (unsigned long long)%cX", 'A' + r);
+    fprintf(f, ", \\\n    (unsigned long long)MEM[0], (unsigned long long)MEM[1])\n\n");
+
+    fprintf(f, "static const char Usage[] =\n    ");
+    EmitString(f, VnpuUsageText, strlen(VnpuUsageText));
+    fprintf(f, ";\n\n");
+
+    fprintf
+    (
+        f,
+        "int main(void)\n"
+        "{\n"
+        "    static char obuf[1 << 16];\n"
+        "    setvbuf(stdout, obuf, _IOFBF, sizeof obuf);\n"
+        "\n"
+    );
+    fprintf(f, "    uint64_t ");
+    for (int r = 0; r < VNPU_REGS; ++r)
+        fprintf(f, "%cX = 0, ", 'A' + r);
+    fprintf(f, "MEM[2] = {0, 0};\n");
+    fprintf(f, "    (void)Usage; (void)PrintWord; (void)MEM;");
+    for (int r = 0; r < VNPU_REGS; ++r)
+        fprintf(f, " (void)%cX;", 'A' + r);
+    fprintf(f, "\n\n");
+
+    bool live = true;
+    for (size_t pc = 0; pc < prog->len && live; ++pc)
+    {
+        const struct VnpuOp *op = &prog->ops[pc];
+        char text[8];
+        VnpuFormatOp(op, text);
+
+        // keep "*/" and friends out of the comment
+        for (char *c = text; *c; ++c)
+            if (*c == '*' || *c == '/') *c = *c == '*' ? 'x' : '|';
+        fprintf(f, "    /* %d: %s */ ", op->line, text);
+
+        switch (op->kind)
+        {
+            case VNPU_OP_HALT:
+                fprintf(f, "return %d;\n", VnpuExitCode(VNPU_HALT_INSTR));
+                live = false;
+                break;
+            case VNPU_OP_USAGE:
+                fprintf(f, "fputs(Usage, stdout);\n");
+                break;
+            case VNPU_OP_EXEC:
+                live = EmitExec(f, op);
+                break;
+            default:
+                fprintf(f, "return Illegal();\n");
+                live = false;
+                break;
+        }
+        if (trace && live)
+            fprintf(f, "    TRACE();\n");
+    }
+
+    if (live)
+        fprintf(f, "    return %d;\n", VnpuExitCode(VNPU_HALT_EOF));
+    fprintf(f, "}\n");
+}
+
+bool Verify(const struct VnpuProgram *prog, const char *name)
+{
+    char dir[] = "/tmp/vnpu-aot-XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("VNPU => mkdtemp");
+        return false;
+    }
+
+    char src[64], bin[64], cmd[512];
+    snprintf(src, sizeof src, "%s/prog.c", dir);
+    snprintf(bin, sizeof bin, "%s/prog", dir);
+
+    FILE *f = fopen(src, "w");
+    if (!f)
+    {
+        perror("VNPU => fopen");
+        rmdir(dir);
+        return false;
+    }
+    Emit(f, prog, name, false);
+    fclose(f);
+
+    const char *cc = getenv("CC");
+    snprintf(cmd, sizeof cmd, "%s -O2 -o %s %s", cc && *cc ? cc : "cc", bin, src);
+    bool ok = system(cmd) == 0;
+    if (!ok)
+        fprintf(stderr, "VNPU => ERROR: \"%s\" failed.\n", cmd);
+
+    // the translated binary
+    char *aot_out = NULL;
+    size_t aot_len = 0;
+    int aot_code = -1;
+    if (ok)
+    {
+        FILE *p = popen(bin, "r");
+        FILE *buf = open_memstream(&aot_out, &aot_len);
+        if (p && buf)
+        {
+            char chunk[4096];
+            size_t got;
+            while ((got = fread(chunk, 1, sizeof chunk, p)) > 0)
+                fwrite(chunk, 1, got, buf);
+            int status = pclose(p);
+            aot_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        if (buf) fclose(buf);
+    }
+
+    // the interpreter, exactly like vnpu-run runs a job
+    char *ref_out = NULL;
+    size_t ref_len = 0;
+    FILE *buf = open_memstream(&ref_out, &ref_len);
+    struct VNPU vm;
+    VnpuReset(&vm, buf);
+    int ref_code = VnpuExitCode(VnpuRun(&vm, prog));
+    fclose(buf);
+
+    if (ok)
+    {
+        if (aot_code != ref_code)
+        {
+            fprintf(stderr, "VNPU => %s: exit code %d, interpreter says %d.\n", name, aot_code, ref_code);
+            ok = false;
+        }
+        if (aot_len != ref_len || memcmp(aot_out, ref_out, ref_len) != 0)
+        {
+            size_t at = 0;
+            while (at < aot_len && at < ref_len && aot_out[at] == ref_out[at]) at++;
+            fprintf(stderr, "VNPU => %s: output differs from the interpreter at byte %zu.\n", name, at);
+            ok = false;
+        }
+    }
+    if (ok)
+        fprintf(stderr, "VNPU => %s: translation matches the interpreter ( %zu bytes, exit code %d ).\n",
+                name, ref_len, ref_code);
+
+    free(aot_out);
+    free(ref_out);
+    unlink(bin);
+    unlink(src);
+    rmdir(dir);
+    return ok;
+}
+
+void printAotUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-aot [-o OUT.c] [--trace] PROGRAM\n"
+        "       vnpu-aot --verify PROGRAM\n"
+        "  -o OUT.c    write the translation to OUT.c instead of stdout\n"
+        "  --trace     make the translation print \"\\001AX BX .. MEM[0] MEM[1]\" after every op\n"
+        "  --verify    compile the translation with $CC ( or cc ), run it, and check that\n"
+        "              its output and exit code match the interpreter's\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    const char *prog_path = NULL;
+    bool verify = false;
+    bool trace = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp(argv[i], "--verify") == 0)
+            verify = true;
+        else if (strcmp(argv[i], "--trace") == 0)
+            trace = true;
+        else if (argv[i][0] == '-' || prog_path)
+        {
+            printAotUsage();
+            return strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+        else
+            prog_path = argv[i];
+    }
+    if (!prog_path)
+    {
+        printAotUsage();
+        return 1;
+    }
+
+    if (VNPU_WORD_SIZE > 32)
+    {
+        fprintf(stderr, "VNPU => ERROR: vnpu-aot only translates words up to 32 bits.\n");
+        return 1;
+    }
+
+    struct VnpuProgram prog;
+    if (!VnpuLoadFile(&prog, prog_path))
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", prog_path);
+        return 1;
+    }
+
+    int status = 0;
+    if (verify)
+        status = Verify(&prog, prog_path) ? 0 : 1;
+    else
+    {
+        FILE *f = out_path ? fopen(out_path, "w") : stdout;
+        if (!f)
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot write \"%s\".\n", out_path);
+            status = 1;
+        }
+        else
+        {
+            Emit(f, &prog, prog_path, trace);
+            if (f != stdout) fclose(f);
+        }
+    }
+
+    VnpuFree(&prog);
+    return status;
+}
@@ -0,0 +1,1031 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "vnpu.h"
+#include "wide.h"
+
+/*
+	vnpu-diff
+	- Generates random v'NIS programs and runs each one on every way this
+	  tree has of executing v'NIS, checking that they all agree with the
+	  reference: vnpu.c's own loop, fgets() into InstructionBuffer,
+	  VnpuDecode(), VnpuStep().
+	- The engines:
+	      step   the pre-decoded program ( VnpuLoad() ) through VnpuRun(),
+	             one op per call
+	      block  VnpuRun() in randomly sized budgets, so blocks get cut
+	             anywhere
+	      prof   VnpuRun() with a profile attached ( the other loop ),
+	             whose counters have to add up too
+	      aot    the program through vnpu-aot --trace and cc, every -a'th
+	             program only, it takes a compiler run
+	- The registers, MEM, the cycles, the bytes printed so far and the halt
+	  reason are compared after every op ( at every budget stop for block
+	  and prof, the registers only for aot ), then the whole output, the
+	  number of ops run and why they stopped.
+	- Most programs get fake I/O ports: a few words queued on every input
+	  port, 'O' logged in between the output, and, except for the
+	  reference, ports that say "not now" every so often so VnpuRun() has
+	  to back out of an op and run it again.
+	- -m makes some lines garbage ( too long, too short, no newline ) for
+	  the INSTR_LEN_LIMIT-byte chunking, which the reference does with a
+	  real fgets().
+	- A program that makes an engine disagree is shrunk, dropping lines
+	  and then single characters while it still does, and the result is
+	  written to DIR/diff-SEED-INDEX.vnis along with how to rerun it.
+	- Program N only depends on the seed and N, whatever -j says.
+	- Exit code: 0 everything agrees, 2 something didn't, 1 on errors.
+*/
+
+// Longest a generated program gets, in lines, unless -l says otherwise
+#define DEFAULT_LINES 24
+// Program indices a worker claims at a time
+#define BATCH_LEN 64
+// Words queued on every input port at most
+#define TAPE_LEN 6
+
+// One comparison point: the machine after the op at index 'at' ran
+struct Step
+{
+    uint64_t R[VNPU_REGS][VNPU_LIMBS];
+    uint64_t MEM[2][VNPU_LIMBS];
+    unsigned long long cycles;
+    size_t out_len;
+    enum VnpuHalt reason; // VNPU_RUNNING unless this op halted
+    unsigned long long at;
+    char op[8];
+};
+
+// Everything one engine did with one program
+struct Trace
+{
+    struct Step *steps;
+    size_t len;
+    size_t cap;
+    char *out;
+    size_t out_len;
+    unsigned long long count; // ops run
+    enum VnpuHalt final;
+    bool regs_only;           // aot: registers in the steps, an exit code for 'final'
+    int exit_code;
+    char note[96];            // something the engine itself noticed was wrong
+};
+
+struct Case
+{
+    char *text;
+    size_t len;
+    size_t cap;
+    uint64_t seed; // input words, blocking, budgets
+    bool ports;
+    bool aot;
+};
+
+struct FakePorts
+{
+    uint64_t tape[VNPU_PORT_COUNT][TAPE_LEN];
+    size_t len[VNPU_PORT_COUNT];
+    size_t pos[VNPU_PORT_COUNT];
+    FILE *out;
+    bool may_block;
+    uint64_t rng;
+};
+
+struct Worker
+{
+    pthread_t thread;
+    struct Trace ref;
+    struct Trace got;
+    struct Case c;
+    char dir[32]; // for aot, made on first use
+    unsigned long long programs;
+    unsigned long long ops;
+};
+
+// SETTINGS ( set once in main() )
+static unsigned long long Seed = 1;
+static unsigned long long First = 0;
+static unsigned long long Count = 100000;
+static int MaxLines = DEFAULT_LINES;
+static int Messy = 0;
+static unsigned long long AotEvery = 0;
+static const char *AotPath = "./vnpu-aot";
+static const char *OutDir = ".";
+static unsigned long long MaxFail = 1;
+
+static atomic_ullong Next;
+static atomic_ullong Failures;
+static pthread_mutex_t ReportLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Rand ( uint64_t *state )
+// ⤷ splitmix64, any state is fine, 0 included
+uint64_t Rand(uint64_t *state);
+
+// Generate ( struct Case *c, unsigned long long index )
+// ⤷ Program 'index' of this seed, and how it is to be run
+bool Generate(struct Case *c, unsigned long long index);
+
+// TraceReference ( struct Trace *t, const struct Case *c )
+// ⤷ Runs 'c' exactly like vnpu.c would, recording every op
+bool TraceReference(struct Trace *t, const struct Case *c);
+
+// TraceStepped / TraceBlocks ( struct Trace *t, const struct Case *c, const struct VnpuProgram *prog, ... )
+// ⤷ Runs the decoded program through VnpuRun(), see the engines above
+bool TraceStepped(struct Trace *t, const struct Case *c, const struct VnpuProgram *prog);
+bool TraceBlocks(struct Trace *t, const struct Case *c, const struct VnpuProgram *prog, bool profile);
+
+// TraceAot ( struct Worker *w, struct Trace *t, const struct Case *c )
+// ⤷ Translates, compiles and runs 'c', reading the registers back from --trace
+bool TraceAot(struct Worker *w, struct Trace *t, const struct Case *c);
+
+// AotWorks ( void )
+// ⤷ Whether vnpu-aot and the C compiler get through a trivial program at all,
+//   so that a broken -x or CC is an error and not a disagreement on every program
+bool AotWorks(void);
+
+// Compare ( const struct Trace *ref, const struct Trace *got, const char *engine, char *why, size_t n )
+// ⤷ False, with the first difference in 'why', unless 'got' agrees with 'ref'
+bool Compare(const struct Trace *ref, const struct Trace *got, const char *engine, char *why, size_t n);
+
+// Check ( struct Worker *w, const struct Case *c, char *why, size_t n )
+// ⤷ Runs 'c' on every engine, false if any of them disagrees ( or can't run it )
+bool Check(struct Worker *w, const struct Case *c, char *why, size_t n);
+
+// Shrink ( struct Worker *w, struct Case *c, char *why, size_t n )
+// ⤷ Makes the failing 'c' as small as it gets while it still fails
+void Shrink(struct Worker *w, struct Case *c, char *why, size_t n);
+
+void printDiffUsage(void);
+
+uint64_t Rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static bool Append(struct Case *c, const char *s, size_t len)
+{
+    if (c->len + len > c->cap)
+    {
+        size_t cap = c->cap ? c->cap * 2 : 256;
+        while (cap < c->len + len) cap *= 2;
+        char *text = realloc(c->text, cap);
+        if (!text) return false;
+        c->text = text;
+        c->cap = cap;
+    }
+    memcpy(c->text + c->len, s, len);
+    c->len += len;
+    return true;
+}
+
+// RandRegister ( uint64_t *rng )
+// ⤷ Mostly A and B, the registers every program has, now and then any of them
+static char RandRegister(uint64_t *rng)
+{
+    if (Rand(rng) % 4 == 0) return (char)('A' + Rand(rng) % VNPU_REGS);
+    return Rand(rng) % 2 ? 'A' : 'B';
+}
+
+static char RandOperand(uint64_t *rng)
+{
+    unsigned roll = (unsigned)(Rand(rng) % 100);
+    if (roll == 0) return "ZX. "[Rand(rng) % 4]; // not an operand
+    if (roll < 70) return RandRegister(rng);
+    return (char)('0' + Rand(rng) % 10);
+}
+
+bool Generate(struct Case *c, unsigned long long index)
+{
+    // weighted towards the ops that neither halt nor do nothing
+    static const char instrs[] = "++++----****/MMMMMM@@@IIIOOO?<>!";
+    static const char junk[] = "  \r\t\nABCP0123456789+-*/M?<>!@IO.HX#";
+    uint64_t rng = Seed ^ (index * 0xD1B54A32D192ED03ull);
+
+    c->len = 0;
+    int lines = 1 + (int)(Rand(&rng) % (uint64_t)MaxLines);
+    for (int i = 0; i < lines; ++i)
+    {
+        char line[16];
+        size_t n = 0;
+        unsigned roll = (unsigned)(Rand(&rng) % 100);
+
+        if (roll < (unsigned)Messy)
+        {
+            n = Rand(&rng) % 14;
+            for (size_t k = 0; k < n; ++k)
+                line[k] = junk[Rand(&rng) % (sizeof junk - 1)];
+            if (Rand(&rng) % 4) line[n++] = '\n';
+        }
+        else if (roll < (unsigned)Messy + 2)
+        {
+            line[n++] = '.';
+            line[n++] = '\n';
+        }
+        else if (roll < (unsigned)Messy + 3)
+        {
+            line[n++] = 'H';
+            line[n++] = '\n';
+        }
+        else
+        {
+            char instr = instrs[Rand(&rng) % (sizeof instrs - 1)];
+            char com1 = RandOperand(&rng), com2 = RandOperand(&rng);
+            if (instr == 'I' || instr == 'O')
+            {
+                // now and then one past the last port
+                com1 = (char)('0' + (Rand(&rng) % 16 ? Rand(&rng) % VNPU_PORT_COUNT : VNPU_PORT_COUNT));
+                if (instr == 'I' && Rand(&rng) % 8) com2 = RandRegister(&rng);
+            }
+            else if (instr == 'M' && Rand(&rng) % 8)
+            {
+                // M takes a register or a digit into any other register
+                com2 = RandRegister(&rng);
+                if (com1 == com2) com1 = com2 == 'A' ? 'B' : 'A';
+            }
+            line[n++] = instr;
+            line[n++] = ' ';
+            line[n++] = com1;
+            if (instr != '@' || Rand(&rng) % 2)
+            {
+                line[n++] = ' ';
+                line[n++] = com2;
+            }
+            if (strchr("+-*/", instr) && Rand(&rng) % 2)
+            {
+                // three operands, the result into the last one
+                line[n++] = ' ';
+                line[n++] = Rand(&rng) % 16 ? RandRegister(&rng) : RandOperand(&rng);
+            }
+            line[n++] = '\n';
+        }
+        if (i == lines - 1 && n > 0 && line[n - 1] == '\n' && Rand(&rng) % 8 == 0)
+            n--;
+        if (!Append(c, line, n)) return false;
+    }
+
+    c->seed = Rand(&rng);
+    c->aot = AotEvery && index % AotEvery == 0;
+    c->ports = !c->aot && Rand(&rng) % 4 != 0; // the translation has no ports
+    return true;
+}
+
+// FAKE PORTS
+//
+static int FakeIn(void *ctx, int port, uint64_t *val)
+{
+    struct FakePorts *fp = ctx;
+    if (fp->may_block && Rand(&fp->rng) % 3 == 0) return VNPU_PORT_BLOCKED;
+    if (fp->pos[port] == fp->len[port]) return VNPU_PORT_CLOSED;
+    *val = fp->tape[port][fp->pos[port]++];
+    return VNPU_PORT_OK;
+}
+
+static int FakeOut(void *ctx, int port, uint64_t val)
+{
+    struct FakePorts *fp = ctx;
+    if (fp->may_block && Rand(&fp->rng) % 3 == 0) return VNPU_PORT_BLOCKED;
+    fprintf(fp->out, "<%d %llu>\n", port, (unsigned long long)val);
+    return VNPU_PORT_OK;
+}
+
+// Attach ( struct VNPU *vm, const struct Case *c, struct FakePorts *fp, struct VnpuPortOps *ops, bool may_block )
+// ⤷ The same tapes for every engine, whatever 'may_block' says
+static void Attach(struct VNPU *vm, const struct Case *c, struct FakePorts *fp, struct VnpuPortOps *ops, bool may_block)
+{
+    if (!c->ports) return;
+
+    uint64_t rng = c->seed;
+    memset(fp, 0, sizeof *fp);
+    for (int p = 0; p < VNPU_PORT_COUNT; ++p)
+    {
+        fp->len[p] = Rand(&rng) % (TAPE_LEN + 1);
+        for (size_t i = 0; i < fp->len[p]; ++i)
+            fp->tape[p][i] = Rand(&rng) >> (Rand(&rng) % 64);
+    }
+    fp->out = vm->out;
+    fp->may_block = may_block;
+    fp->rng = Rand(&rng);
+
+    ops->In = FakeIn;
+    ops->Out = FakeOut;
+    ops->ctx = fp;
+    ops->print_out = false;
+    vm->ports = ops;
+}
+
+// TRACES
+//
+static FILE *Begin(struct Trace *t)
+{
+    free(t->out);
+    t->out = NULL;
+    t->out_len = 0;
+    t->len = 0;
+    t->count = 0;
+    t->final = VNPU_RUNNING;
+    t->regs_only = false;
+    t->exit_code = -1;
+    t->note[0] = '\0';
+    return open_memstream(&t->out, &t->out_len);
+}
+
+static struct Step *NewStep(struct Trace *t)
+{
+    if (t->len == t->cap)
+    {
+        size_t cap = t->cap ? t->cap * 2 : 64;
+        struct Step *steps = realloc(t->steps, cap * sizeof *steps);
+        if (!steps) return NULL;
+        t->steps = steps;
+        t->cap = cap;
+    }
+    return &t->steps[t->len++];
+}
+
+static bool Record(struct Trace *t, struct VNPU *vm, unsigned long long at, enum VnpuHalt reason, const struct VnpuOp *op)
+{
+    struct Step *s = NewStep(t);
+    if (!s) return false;
+
+    fflush(vm->out); // brings t->out_len up to date
+    for (int r = 0; r < VNPU_REGS; ++r)
+        WideCopy(s->R[r], vm->R[r], VNPU_LIMBS);
+    WideCopy(s->MEM[0], vm->MEM[0], VNPU_LIMBS);
+    WideCopy(s->MEM[1], vm->MEM[1], VNPU_LIMBS);
+    s->cycles = vm->cycles;
+    s->out_len = t->out_len;
+    s->reason = reason;
+    s->at = at;
+    VnpuFormatOp(op, s->op);
+    return true;
+}
+
+// the reason to record for the op VnpuRun() stopped after
+static enum VnpuHalt OpReason(enum VnpuHalt r)
+{
+    return r == VNPU_RUNNING || r == VNPU_HALT_INSN_LIMIT || r == VNPU_HALT_EOF ? VNPU_RUNNING : r;
+}
+
+bool TraceReference(struct Trace *t, const struct Case *c)
+{
+    FILE *out = Begin(t);
+    if (!out) return false;
+
+    struct VNPU vm;
+    struct FakePorts fp;
+    struct VnpuPortOps ops;
+    VnpuReset(&vm, out);
+    Attach(&vm, c, &fp, &ops, false);
+
+    bool ok = true;
+    FILE *in = c->len ? fmemopen(c->text, c->len, "r") : NULL;
+    while (in && !vm.HALT)
+    {
+        if (!fgets(vm.InstructionBuffer, INSTR_LEN_LIMIT, in))
+            break;
+
+        struct VnpuOp op;
+        if (!VnpuDecode(vm.InstructionBuffer, &op)) continue;
+
+        VnpuStep(&vm, &op);
+        if (!Record(t, &vm, t->count++, vm.HaltReason, &op))
+        {
+            ok = false;
+            break;
+        }
+    }
+    if (in) fclose(in);
+    else if (c->len) ok = false;
+
+    t->final = vm.HALT ? vm.HaltReason : VNPU_HALT_EOF;
+    fclose(out);
+    return ok;
+}
+
+bool TraceStepped(struct Trace *t, const struct Case *c, const struct VnpuProgram *prog)
+{
+    FILE *out = Begin(t);
+    if (!out) return false;
+
+    struct VNPU vm;
+    struct FakePorts fp;
+    struct VnpuPortOps ops;
+    VnpuReset(&vm, out);
+    Attach(&vm, c, &fp, &ops, true);
+
+    bool ok = true;
+    for (;;)
+    {
+        unsigned long long before = vm.insns;
+        vm.limits.max_insns = before + 1;
+        enum VnpuHalt r = VnpuRun(&vm, prog);
+        if (r == VNPU_RUNNING) continue; // a port said "not now"
+
+        if (vm.insns > before && !Record(t, &vm, before, OpReason(r), &prog->ops[before]))
+        {
+            ok = false;
+            break;
+        }
+        if (r != VNPU_HALT_INSN_LIMIT)
+        {
+            t->final = r;
+            break;
+        }
+        vm.HALT = false;
+        vm.HaltReason = VNPU_RUNNING;
+    }
+
+    t->count = vm.insns;
+    fclose(out);
+    return ok;
+}
+
+bool TraceBlocks(struct Trace *t, const struct Case *c, const struct VnpuProgram *prog, bool profile)
+{
+    FILE *out = Begin(t);
+    if (!out) return false;
+
+    struct VNPU vm;
+    struct FakePorts fp;
+    struct VnpuPortOps ops;
+    struct VnpuProfile prof;
+    VnpuReset(&vm, out);
+    Attach(&vm, c, &fp, &ops, true);
+    if (profile)
+    {
+        if (!VnpuProfileInit(&prof, prog))
+        {
+            fclose(out);
+            return false;
+        }
+        vm.prof = &prof;
+    }
+
+    bool ok = true;
+    uint64_t rng = c->seed ^ (profile ? 0x50524F46ull : 0x424C4Bull);
+    for (;;)
+    {
+        // a quarter of the time no budget at all, the rest 1 .. 300 ops
+        uint64_t roll = Rand(&rng) % 400;
+        vm.limits.max_insns = roll < 100 ? 0 : vm.insns + roll - 99;
+        enum VnpuHalt r = VnpuRun(&vm, prog);
+
+        if (vm.insns > 0 && !Record(t, &vm, vm.insns - 1, OpReason(r), &prog->ops[vm.insns - 1]))
+        {
+            ok = false;
+            break;
+        }
+        if (r != VNPU_RUNNING && r != VNPU_HALT_INSN_LIMIT)
+        {
+            t->final = r;
+            break;
+        }
+        vm.HALT = false;
+        vm.HaltReason = VNPU_RUNNING;
+    }
+    t->count = vm.insns;
+
+    if (profile)
+    {
+        // no jumps: every op up to the last one ran exactly once
+        unsigned long long cycles = 0;
+        for (size_t pc = 0; pc < prog->len; ++pc)
+        {
+            unsigned long long want = pc < vm.insns ? 1 : 0;
+            if (prof.insns[pc] != want && !t->note[0])
+                snprintf(t->note, sizeof t->note, "op #%zu counted %llu times instead of %llu",
+                         pc, prof.insns[pc], want);
+            cycles += prof.cycles[pc];
+        }
+        if (cycles != vm.cycles && !t->note[0])
+            snprintf(t->note, sizeof t->note, "the profile has %llu cycles, the machine %llu",
+                     cycles, vm.cycles);
+        VnpuProfileFree(&prof);
+    }
+    fclose(out);
+    return ok;
+}
+
+bool TraceAot(struct Worker *w, struct Trace *t, const struct Case *c)
+{
+    char src[64], prog_c[64], bin[64], cmd[512];
+    const char *cc = getenv("CC");
+
+    FILE *out = Begin(t);
+    if (!out) return false;
+    t->regs_only = true;
+
+    if (!w->dir[0])
+    {
+        strcpy(w->dir, "/tmp/vnpu-diff-XXXXXX");
+        if (!mkdtemp(w->dir))
+        {
+            perror("VNPU => mkdtemp");
+            w->dir[0] = '\0';
+            fclose(out);
+            return false;
+        }
+    }
+    snprintf(src, sizeof src, "%s/prog.vnis", w->dir);
+    snprintf(prog_c, sizeof prog_c, "%s/prog.c", w->dir);
+    snprintf(bin, sizeof bin, "%s/prog", w->dir);
+
+    FILE *f = fopen(src, "w");
+    if (!f)
+    {
+        fclose(out);
+        return false;
+    }
+    fwrite(c->text, 1, c->len, f);
+    fclose(f);
+
+    snprintf(cmd, sizeof cmd, "%s --trace -o %s %s && %s -O0 -w -o %s %s",
+             AotPath, prog_c, src, cc && *cc ? cc : "cc", bin, prog_c);
+    if (system(cmd) != 0)
+    {
+        snprintf(t->note, sizeof t->note, "translating or compiling failed");
+        fclose(out);
+        return true;
+    }
+
+    // the translation's own output, with "\001AX BX .. MEM[0] MEM[1]" lines in between
+    FILE *p = popen(bin, "r");
+    if (!p)
+    {
+        fclose(out);
+        return false;
+    }
+    // '@' prints whatever byte follows it, NULs included
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, p)) > 0)
+    {
+        if (line[0] != '\001')
+        {
+            fwrite(line, 1, (size_t)n, out);
+            continue;
+        }
+        // every register, then MEM[0] and MEM[1]
+        unsigned long long words[VNPU_REGS + 2];
+        struct Step *s = NewStep(t);
+        int k = 0, used = 0;
+        char *at = line + 1;
+        while (s && k < VNPU_REGS + 2 && sscanf(at, "%llu%n", &words[k], &used) == 1)
+        {
+            at += used;
+            k++;
+        }
+        if (!s || k != VNPU_REGS + 2)
+        {
+            if (!t->note[0]) snprintf(t->note, sizeof t->note, "unreadable trace line");
+            continue;
+        }
+        memset(s, 0, sizeof *s);
+        for (int r = 0; r < VNPU_REGS; ++r)
+            WideSet(s->R[r], words[r], VNPU_LIMBS);
+        WideSet(s->MEM[0], words[VNPU_REGS], VNPU_LIMBS);
+        WideSet(s->MEM[1], words[VNPU_REGS + 1], VNPU_LIMBS);
+        s->at = t->len - 1;
+    }
+    free(line);
+    int status = pclose(p);
+    t->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    t->count = t->len;
+    fclose(out);
+    return true;
+}
+
+static void RemoveDir(struct Worker *w)
+{
+    if (!w->dir[0]) return;
+    char path[64];
+    static const char *files[] = { "prog.vnis", "prog.c", "prog" };
+    for (int k = 0; k < 3; ++k)
+    {
+        snprintf(path, sizeof path, "%s/%s", w->dir, files[k]);
+        unlink(path);
+    }
+    rmdir(w->dir);
+    w->dir[0] = '\0';
+}
+
+bool AotWorks(void)
+{
+    struct Worker w = {0};
+    struct Trace t = {0};
+    char text[] = "+ A 1\n";
+    struct Case c = { .text = text, .len = sizeof text - 1, .aot = true };
+
+    bool ok = TraceAot(&w, &t, &c) && !t.note[0];
+    free(t.steps);
+    free(t.out);
+    RemoveDir(&w);
+    return ok;
+}
+
+// COMPARING
+//
+static void Word(char *buf, size_t cap, const uint64_t word[VNPU_LIMBS])
+{
+    WideToDec(buf, cap, word, VNPU_LIMBS);
+}
+
+bool Compare(const struct Trace *ref, const struct Trace *got, const char *engine, char *why, size_t n)
+{
+    if (got->note[0])
+    {
+        snprintf(why, n, "%s: %s", engine, got->note);
+        return false;
+    }
+
+    for (size_t i = 0; i < got->len; ++i)
+    {
+        const struct Step *g = &got->steps[i];
+        if (g->at >= ref->len)
+        {
+            snprintf(why, n, "%s ran op #%llu, the reference stopped after %llu ops",
+                     engine, g->at, ref->count);
+            return false;
+        }
+        const struct Step *r = &ref->steps[g->at];
+
+        // the registers in order, then MEM[0] and MEM[1]
+        char a[VNPU_LIMBS * 20 + 1], b[VNPU_LIMBS * 20 + 1], name[8];
+        for (int k = 0; k < VNPU_REGS + 2; ++k)
+        {
+            const uint64_t *rw = k < VNPU_REGS ? r->R[k] : r->MEM[k - VNPU_REGS];
+            const uint64_t *gw = k < VNPU_REGS ? g->R[k] : g->MEM[k - VNPU_REGS];
+            if (WideCmp(rw, gw, VNPU_LIMBS) == 0) continue;
+            if (k < VNPU_REGS) snprintf(name, sizeof name, "%cX", 'A' + k);
+            else snprintf(name, sizeof name, "MEM[%d]", k - VNPU_REGS);
+            Word(a, sizeof a, gw);
+            Word(b, sizeof b, rw);
+            snprintf(why, n, "after op #%llu \"%s\": %s %s is %s, the reference has %s",
+                     g->at, r->op, engine, name, a, b);
+            return false;
+        }
+        if (got->regs_only) continue;
+
+        if (g->cycles != r->cycles)
+        {
+            snprintf(why, n, "after op #%llu \"%s\": %s has %llu cycles, the reference %llu",
+                     g->at, r->op, engine, g->cycles, r->cycles);
+            return false;
+        }
+        if (g->out_len != r->out_len)
+        {
+            snprintf(why, n, "after op #%llu \"%s\": %s printed %zu bytes, the reference %zu",
+                     g->at, r->op, engine, g->out_len, r->out_len);
+            return false;
+        }
+        if (g->reason != r->reason)
+        {
+            snprintf(why, n, "after op #%llu \"%s\": %s says \"%s\", the reference \"%s\"",
+                     g->at, r->op, engine, VnpuHaltName(g->reason), VnpuHaltName(r->reason));
+            return false;
+        }
+    }
+
+    if (got->regs_only)
+    {
+        // the translation traces the ops that didn't halt
+        unsigned long long want = ref->count;
+        if (want > 0 && ref->steps[want - 1].reason != VNPU_RUNNING) want--;
+        if (got->count != want)
+        {
+            snprintf(why, n, "%s traced %llu ops, the reference ran %llu without halting",
+                     engine, got->count, want);
+            return false;
+        }
+        if (got->exit_code != VnpuExitCode(ref->final))
+        {
+            snprintf(why, n, "%s exited with %d, the reference halts with \"%s\" ( %d )",
+                     engine, got->exit_code, VnpuHaltName(ref->final), VnpuExitCode(ref->final));
+            return false;
+        }
+    }
+    else
+    {
+        if (got->count != ref->count)
+        {
+            snprintf(why, n, "%s ran %llu ops, the reference %llu", engine, got->count, ref->count);
+            return false;
+        }
+        if (got->final != ref->final)
+        {
+            snprintf(why, n, "%s stopped with \"%s\", the reference with \"%s\"",
+                     engine, VnpuHaltName(got->final), VnpuHaltName(ref->final));
+            return false;
+        }
+    }
+
+    if (got->out_len != ref->out_len || memcmp(got->out, ref->out, ref->out_len) != 0)
+    {
+        size_t at = 0;
+        while (at < got->out_len && at < ref->out_len && got->out[at] == ref->out[at]) at++;
+        snprintf(why, n, "%s output differs from the reference at byte %zu ( %zu / %zu bytes )",
+                 engine, at, got->out_len, ref->out_len);
+        return false;
+    }
+    return true;
+}
+
+bool Check(struct Worker *w, const struct Case *c, char *why, size_t n)
+{
+    struct VnpuProgram prog;
+    if (!TraceReference(&w->ref, c) || !VnpuLoad(&prog, c->text, c->len))
+    {
+        snprintf(why, n, "out of memory");
+        return false;
+    }
+
+    bool ok = TraceStepped(&w->got, c, &prog) && Compare(&w->ref, &w->got, "step", why, n)
+           && TraceBlocks(&w->got, c, &prog, false) && Compare(&w->ref, &w->got, "block", why, n)
+           && TraceBlocks(&w->got, c, &prog, true) && Compare(&w->ref, &w->got, "prof", why, n);
+    if (ok && c->aot)
+    {
+        if (!TraceAot(w, &w->got, c))
+        {
+            snprintf(why, n, "aot: cannot run the translation");
+            ok = false;
+        }
+        else
+            ok = Compare(&w->ref, &w->got, "aot", why, n);
+    }
+
+    w->ops += w->ref.count;
+    VnpuFree(&prog);
+    return ok;
+}
+
+// SHRINKING
+//
+// Try ( struct Worker *w, struct Case *c, struct Case *trial, char *why, size_t n )
+// ⤷ If 'trial' still fails, it becomes 'c'
+static bool Try(struct Worker *w, struct Case *c, struct Case *trial, char *why, size_t n)
+{
+    char trial_why[512];
+    if (Check(w, trial, trial_why, sizeof trial_why)) return false;
+
+    struct Case tmp = *c;
+    *c = *trial;
+    *trial = tmp;
+    snprintf(why, n, "%s", trial_why);
+    return true;
+}
+
+// LineStart ( const struct Case *c, size_t k )
+// ⤷ Offset of line 'k', c->len if there is no such line
+static size_t LineStart(const struct Case *c, size_t k)
+{
+    size_t i = 0;
+    while (k > 0 && i < c->len)
+        if (c->text[i++] == '\n') k--;
+    return i;
+}
+
+void Shrink(struct Worker *w, struct Case *c, char *why, size_t n)
+{
+    struct Case trial = *c;
+    trial.text = NULL;
+    trial.len = trial.cap = 0;
+
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+
+        size_t lines = 0;
+        for (size_t i = 0; i < c->len; ++i)
+            if (c->text[i] == '\n') lines++;
+        if (c->len > 0 && c->text[c->len - 1] != '\n') lines++;
+
+        // whole lines, halves first
+        for (size_t chunk = lines / 2 ? lines / 2 : 1; chunk > 0; chunk /= 2)
+        {
+            for (size_t k = 0; LineStart(c, k) < c->len; )
+            {
+                size_t from = LineStart(c, k), to = LineStart(c, k + chunk);
+                trial.len = 0;
+                if (!Append(&trial, c->text, from) || !Append(&trial, c->text + to, c->len - to))
+                    goto done;
+                if (Try(w, c, &trial, why, n))
+                    progress = true;
+                else
+                    k += chunk;
+            }
+        }
+
+        // then single characters
+        for (size_t i = 0; i < c->len; )
+        {
+            trial.len = 0;
+            if (!Append(&trial, c->text, i) || !Append(&trial, c->text + i + 1, c->len - i - 1))
+                goto done;
+            if (Try(w, c, &trial, why, n))
+                progress = true;
+            else
+                i++;
+        }
+    }
+done:
+    free(trial.text);
+}
+
+static void Report(struct Worker *w, unsigned long long index, size_t before, const char *why)
+{
+    char path[4096];
+    snprintf(path, sizeof path, "%s/diff-%llu-%llu.vnis", OutDir, Seed, index);
+
+    pthread_mutex_lock(&ReportLock);
+    FILE *f = fopen(path, "w");
+    if (f)
+    {
+        fwrite(w->c.text, 1, w->c.len, f);
+        fclose(f);
+    }
+    else
+        perror("VNPU => fopen");
+
+    size_t lines = 0;
+    for (size_t i = 0; i < w->c.len; ++i)
+        if (w->c.text[i] == '\n') lines++;
+    if (w->c.len > 0 && w->c.text[w->c.len - 1] != '\n') lines++;
+
+    fprintf(stderr, "VNPU => DIVERGENCE in program %llu: %s\n", index, why);
+    fprintf(stderr, "\t=> shrunk from %zu to %zu bytes ( %zu lines ), written to %s:\n", before, w->c.len, lines, path);
+    fprintf(stderr, "\t   ");
+    for (size_t i = 0; i < w->c.len; ++i)
+    {
+        char ch = w->c.text[i];
+        if (ch == '\n')
+            fprintf(stderr, "\\n\n\t   ");
+        else if (ch == '\r')
+            fprintf(stderr, "\\r");
+        else if (ch == '\t')
+            fprintf(stderr, "\\t");
+        else
+            fputc(ch, stderr);
+    }
+    fprintf(stderr, "\n\t=> rerun with: vnpu-diff -s %llu -i %llu -n 1 -l %d -m %d%s%s\n",
+            Seed, index, MaxLines, Messy, w->c.aot ? " -a 1 -x " : "", w->c.aot ? AotPath : "");
+    pthread_mutex_unlock(&ReportLock);
+}
+
+static void *WorkerMain(void *arg)
+{
+    struct Worker *w = arg;
+    char why[512];
+
+    while (atomic_load_explicit(&Failures, memory_order_relaxed) < MaxFail)
+    {
+        unsigned long long from = atomic_fetch_add_explicit(&Next, BATCH_LEN, memory_order_relaxed);
+        if (from >= Count) break;
+        unsigned long long to = from + BATCH_LEN < Count ? from + BATCH_LEN : Count;
+
+        for (unsigned long long i = from; i < to; ++i)
+        {
+            unsigned long long index = First + i;
+            if (!Generate(&w->c, index))
+            {
+                fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+                atomic_store(&Failures, MaxFail);
+                return NULL;
+            }
+            w->programs++;
+            if (Check(w, &w->c, why, sizeof why)) continue;
+
+            if (atomic_fetch_add(&Failures, 1) >= MaxFail) return NULL;
+            size_t before = w->c.len;
+            Shrink(w, &w->c, why, sizeof why);
+            Report(w, index, before, why);
+            if (atomic_load(&Failures) >= MaxFail) return NULL;
+        }
+    }
+    return NULL;
+}
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void printDiffUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-diff [-n COUNT] [-s SEED] [-i FIRST] [-j THREADS] [-l LINES] [-m PERCENT]\n"
+        "                 [-a EVERY] [-x VNPU-AOT] [-o DIR] [-f FAILURES]\n"
+        "  -n COUNT     programs to check ( default: 100000 )\n"
+        "  -s SEED      seed for the programs ( default: 1 )\n"
+        "  -i FIRST     index of the first program ( default: 0 )\n"
+        "  -j THREADS   worker threads ( default: one per core )\n"
+        "  -l LINES     longest program, in lines ( default: %d )\n"
+        "  -m PERCENT   lines that are garbage ( default: 0 )\n"
+        "  -a EVERY     also check every EVERY'th program on vnpu-aot ( default: never )\n"
+        "  -x VNPU-AOT  the vnpu-aot to use, built with the same word size ( default: ./vnpu-aot )\n"
+        "  -o DIR       where shrunk programs go ( default: . )\n"
+        "  -f FAILURES  stop after this many disagreements ( default: 1 )\n",
+        DEFAULT_LINES
+    );
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:i:j:l:m:a:x:o:f:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': Count = strtoull(optarg, NULL, 10); break;
+            case 's': Seed = strtoull(optarg, NULL, 10); break;
+            case 'i': First = strtoull(optarg, NULL, 10); break;
+            case 'j': threads = strtol(optarg, NULL, 10); break;
+            case 'l': MaxLines = atoi(optarg); break;
+            case 'm': Messy = atoi(optarg); break;
+            case 'a': AotEvery = strtoull(optarg, NULL, 10); break;
+            case 'x': AotPath = optarg; break;
+            case 'o': OutDir = optarg; break;
+            case 'f': MaxFail = strtoull(optarg, NULL, 10); break;
+            default:
+                printDiffUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc || threads < 1 || MaxLines < 1 || Messy < 0 || Messy > 97 || MaxFail < 1)
+    {
+        printDiffUsage();
+        return 1;
+    }
+    if (AotEvery && VNPU_WORD_SIZE > 32)
+    {
+        fprintf(stderr, "VNPU => ERROR: vnpu-aot only translates words up to 32 bits, this is %d.\n",
+                VNPU_WORD_SIZE);
+        return 1;
+    }
+    if (AotEvery && !AotWorks())
+    {
+        fprintf(stderr, "VNPU => ERROR: %s cannot translate and compile a trivial program, see -x and CC.\n",
+                AotPath);
+        return 1;
+    }
+
+    struct Worker *workers = calloc((size_t)threads, sizeof *workers);
+    if (!workers)
+    {
+        fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+        return 1;
+    }
+
+    double start = NowSec();
+    long started = 0;
+    for (; started < threads; ++started)
+        if (pthread_create(&workers[started].thread, NULL, WorkerMain, &workers[started]) != 0)
+            break;
+    if (started == 0)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot start any workers.\n");
+        free(workers);
+        return 1;
+    }
+
+    unsigned long long programs = 0, ops = 0;
+    for (long i = 0; i < started; ++i)
+    {
+        struct Worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        programs += w->programs;
+        ops += w->ops;
+        free(w->ref.steps);
+        free(w->ref.out);
+        free(w->got.steps);
+        free(w->got.out);
+        free(w->c.text);
+        RemoveDir(w);
+    }
+    free(workers);
+    double elapsed = NowSec() - start;
+
+    unsigned long long failures = atomic_load(&Failures);
+    if (failures > MaxFail) failures = MaxFail;
+    fprintf(stderr, "VNPU => %llu programs ( %llu ops ) checked in %.3f s, %.0f programs/s, %llu disagreement%s.\n",
+            programs, ops, elapsed, elapsed > 0 ? (double)programs / elapsed : 0.0,
+            failures, failures == 1 ? "" : "s");
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vnpu.h"
+
+#if VNPU_WORD_SIZE != 8
+#error "vnpu-explore packs 8-bit machines only"
+#endif
+
+/*
+	vnpu-explore
+	- Runs a program from every initial state at once and looks at every
+	  state it can reach, to prove it can't fault before it is deployed.
+	- The whole architectural state of the 8-bit machine ( AX, BX and any
+	  other register the program names, both MEM words, why it halted and
+	  the op it is at ) packs into one 64-bit key, see Pack(). Every extra
+	  register costs the pc 8 bits, a program too long for what is left
+	  can't be explored. Keys are deduplicated in a lock-free open-addressing
+	  hash set ( CAS on empty slots ) and expanded breadth-first, the
+	  frontier split in chunks over every core.
+	- v'NIS has no jumps, so every state in BFS level N sits at op N:
+	  one set per level is exact and memory only has to hold two levels.
+	- 'I' has no host here, so it branches into every possible word plus
+	  a closed port; 'O' and '@' go nowhere.
+	- Reports, per op, how many of the states that got there halt on a
+	  division by zero or an illegal instruction ( with one of them as an
+	  example ), and the ops no state ever reaches.
+	- Exit code: 0 safe, 2 some state faults, 3 the state limit was hit
+	  before anything faulted ( nothing proven ), 1 on errors.
+*/
+
+#define CACHE_LINE 64
+// Frontier states a worker claims at a time
+#define CHUNK_LEN 1024
+// States a worker collects before publishing them to the next frontier
+#define OUTBOX_LEN 512
+
+// Key layout, from the top: always-set marker ( so 0 is an empty slot ),
+// PcBits bits of pc, 4 bits of HaltReason, MEM[1], MEM[0], then a byte
+// per register in Packed[], AX lowest
+#define KEY_MARK (UINT64_C(1) << 63)
+#define KEY_PC_BITS_MAX 27
+
+struct StateSet
+{
+    atomic_uint_fast64_t *slots;
+    size_t mask;
+    size_t limit;         // refuse to hold more than this, never past half full
+    atomic_size_t count;
+};
+
+// What happened at one op, over every state that reached it
+struct OpStats
+{
+    unsigned long long reached;
+    atomic_ullong divzero;
+    atomic_ullong illegal;
+    atomic_ullong halted;                 // cleanly: '.' or a closed input
+    atomic_uint_fast64_t divzero_example; // a state right before the fault, 0 for none
+    atomic_uint_fast64_t illegal_example;
+};
+
+struct Worker
+{
+    _Alignas(CACHE_LINE) pthread_t thread;
+    int id;
+    uint64_t outbox[OUTBOX_LEN];
+    size_t outbox_len;
+};
+
+struct VnpuProgram Prog;
+int Packed[VNPU_REGS]; // registers in the key: A, B, then the ones Prog names
+int PackedLen;
+int PcBits;
+struct OpStats *Stats;
+struct Worker *Workers;
+int WorkerCount;
+pthread_barrier_t Barrier;
+
+// The level being expanded ( Frontier, all at op 'Level' ) and the next one
+uint64_t *Frontier;
+size_t FrontierLen;
+_Alignas(CACHE_LINE) atomic_size_t FrontierNext; // next chunk to claim
+uint64_t *NextFrontier;
+_Alignas(CACHE_LINE) atomic_size_t NextLen;
+struct StateSet NextSet;
+size_t Level;
+bool Done = false;
+atomic_bool Overflow = false; // a state didn't fit in NextSet
+size_t MaxStates = (size_t)1 << 22;
+
+// PickRegisters ( const struct VnpuProgram *prog )
+// ⤷ Fills Packed[] and PcBits, false if 'prog' is too long for what is left
+bool PickRegisters(const struct VnpuProgram *prog);
+
+// Pack ( const struct VNPU *vm ) / Unpack ( uint64_t key, struct VNPU *vm )
+// ⤷ Between a machine ( pc included ) and its 64-bit key
+uint64_t Pack(const struct VNPU *vm);
+void Unpack(uint64_t key, struct VNPU *vm);
+
+// SetInit ( struct StateSet *set, size_t expected, size_t limit ) / SetFree ( struct StateSet *set )
+bool SetInit(struct StateSet *set, size_t expected, size_t limit);
+void SetFree(struct StateSet *set);
+
+// SetInsert ( struct StateSet *set, uint64_t key )
+// ⤷ 1 if 'key' is new, 0 if it was already there, -1 if the set is full
+int SetInsert(struct StateSet *set, uint64_t key);
+
+// Expand ( struct Worker *self, uint64_t key )
+// ⤷ Every successor of one frontier state: live ones go to the next level,
+//   halts are tallied in Stats[]
+void Expand(struct Worker *self, uint64_t key);
+
+void *WorkerMain(void *arg);
+void printExploreUsage(void);
+
+bool PickRegisters(const struct VnpuProgram *prog)
+{
+    bool named[VNPU_REGS] = { true, true }; // AX is every result's default
+    for (size_t i = 0; i < prog->len; ++i)
+    {
+        const struct VnpuOp *op = &prog->ops[i];
+        if (op->kind != VNPU_OP_EXEC) continue;
+        const char coms[] = { op->com1, op->com2, op->com3 };
+        for (int k = 0; k < 3; ++k)
+            if (RegisterIndex(coms[k]) >= 0) named[RegisterIndex(coms[k])] = true;
+    }
+
+    PackedLen = 0;
+    for (int r = 0; r < VNPU_REGS; ++r)
+        if (named[r]) Packed[PackedLen++] = r;
+    PcBits = KEY_PC_BITS_MAX - 8 * (PackedLen - 2);
+    return PcBits > 0 && prog->len < (size_t)1 << PcBits;
+}
+
+uint64_t Pack(const struct VNPU *vm)
+{
+    int shift = 8 * PackedLen;
+    uint64_t key = KEY_MARK
+                 | (uint64_t)vm->pc << (shift + 20)
+                 | (uint64_t)vm->HaltReason << (shift + 16)
+                 | vm->MEM[1][0] << (shift + 8)
+                 | vm->MEM[0][0] << shift;
+    for (int i = 0; i < PackedLen; ++i)
+        key |= vm->R[Packed[i]][0] << (8 * i);
+    return key;
+}
+
+void Unpack(uint64_t key, struct VNPU *vm)
+{
+    int shift = 8 * PackedLen;
+    VnpuReset(vm, NULL);
+    for (int i = 0; i < PackedLen; ++i)
+        vm->R[Packed[i]][0] = (key >> (8 * i)) & 0xff;
+    vm->MEM[0][0]  = (key >> shift) & 0xff;
+    vm->MEM[1][0]  = (key >> (shift + 8)) & 0xff;
+    vm->HaltReason = (enum VnpuHalt)((key >> (shift + 16)) & 0xf);
+    vm->pc         = (size_t)((key >> (shift + 20)) & ((UINT64_C(1) << PcBits) - 1));
+}
+
+static inline uint64_t Mix(uint64_t x) // splitmix64's finalizer
+{
+    x ^= x >> 30; x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27; x *= UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+bool SetInit(struct StateSet *set, size_t expected, size_t limit)
+{
+    if (expected > limit) expected = limit;
+    size_t cap = 64;
+    while (cap < 2 * expected) cap *= 2; // at most half full
+
+    // calloc() of a big table is fresh zero pages, nothing to clear
+    set->slots = calloc(cap, sizeof *set->slots);
+    if (!set->slots) return false;
+    set->mask = cap - 1;
+    set->limit = expected;
+    atomic_init(&set->count, 0);
+    return true;
+}
+
+void SetFree(struct StateSet *set)
+{
+    free(set->slots);
+    set->slots = NULL;
+}
+
+int SetInsert(struct StateSet *set, uint64_t key)
+{
+    for (size_t i = Mix(key) & set->mask; ; i = (i + 1) & set->mask)
+    {
+        uint_fast64_t seen = atomic_load_explicit(&set->slots[i], memory_order_relaxed);
+        if (seen == key) return 0;
+        if (seen != 0) continue;
+
+        // claim the slot before filling it, so the table never gets past half full
+        if (atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed) >= set->limit)
+        {
+            atomic_fetch_sub_explicit(&set->count, 1, memory_order_relaxed);
+            return -1;
+        }
+        if (atomic_compare_exchange_strong_explicit(&set->slots[i], &seen, key,
+                memory_order_relaxed, memory_order_relaxed))
+            return 1;
+        atomic_fetch_sub_explicit(&set->count, 1, memory_order_relaxed);
+        if (seen == key) return 0; // somebody beat us to it with the same state
+    }
+}
+
+static void Flush(struct Worker *self)
+{
+    size_t at = atomic_fetch_add_explicit(&NextLen, self->outbox_len, memory_order_relaxed);
+    memcpy(&NextFrontier[at], self->outbox, self->outbox_len * sizeof *self->outbox);
+    self->outbox_len = 0;
+}
+
+// The input port of a machine being explored: hands out one chosen word
+struct GivenInput
+{
+    uint64_t word;
+    bool closed;
+    bool asked;
+};
+
+static int GivenIn(void *ctx, int port, uint64_t *val)
+{
+    struct GivenInput *in = ctx;
+    (void)port;
+    in->asked = true;
+    if (in->closed) return VNPU_PORT_CLOSED;
+    *val = in->word;
+    return VNPU_PORT_OK;
+}
+
+static int NowhereOut(void *ctx, int port, uint64_t val)
+{
+    (void)ctx; (void)port; (void)val;
+    return VNPU_PORT_OK;
+}
+
+// Successor ( struct Worker *self, uint64_t key, struct GivenInput *in )
+// ⤷ Runs the op at the state's pc once, with 'in' as the input port
+static void Successor(struct Worker *self, uint64_t key, struct GivenInput *in)
+{
+    struct VnpuPortOps ports = { .In = GivenIn, .Out = NowhereOut, .ctx = in };
+    struct VNPU vm;
+    Unpack(key, &vm);
+    vm.ports = &ports;
+
+    struct OpStats *st = &Stats[vm.pc];
+    uint_fast64_t none = 0;
+    VnpuStep(&vm, &Prog.ops[vm.pc]);
+    switch (vm.HaltReason)
+    {
+        case VNPU_RUNNING:
+            break;
+        case VNPU_HALT_DIVZERO:
+            atomic_fetch_add_explicit(&st->divzero, 1, memory_order_relaxed);
+            atomic_compare_exchange_strong_explicit(&st->divzero_example, &none, key,
+                memory_order_relaxed, memory_order_relaxed);
+            return;
+        case VNPU_HALT_ILLEGAL:
+            atomic_fetch_add_explicit(&st->illegal, 1, memory_order_relaxed);
+            atomic_compare_exchange_strong_explicit(&st->illegal_example, &none, key,
+                memory_order_relaxed, memory_order_relaxed);
+            return;
+        default:
+            atomic_fetch_add_explicit(&st->halted, 1, memory_order_relaxed);
+            return;
+    }
+
+    vm.pc++;
+    if (vm.pc == Prog.len) return; // end of program, nothing left to go wrong
+
+    int fresh = SetInsert(&NextSet, Pack(&vm));
+    if (fresh < 0)
+        atomic_store_explicit(&Overflow, true, memory_order_relaxed);
+    else if (fresh > 0)
+    {
+        self->outbox[self->outbox_len++] = Pack(&vm);
+        if (self->outbox_len == OUTBOX_LEN) Flush(self);
+    }
+}
+
+void Expand(struct Worker *self, uint64_t key)
+{
+    struct GivenInput in = { 0, false, false };
+    Successor(self, key, &in);
+    if (!in.asked) return;
+
+    // it read a word: every other word it could have read, then no word at all
+    for (unsigned w = 1; w < 256; ++w)
+    {
+        in.word = w;
+        Successor(self, key, &in);
+    }
+    in.closed = true;
+    Successor(self, key, &in);
+}
+
+// ExpandLevel ( struct Worker *self )
+// ⤷ Claims frontier chunks until there are none left
+static void ExpandLevel(struct Worker *self)
+{
+    for (;;)
+    {
+        size_t from = atomic_fetch_add_explicit(&FrontierNext, CHUNK_LEN, memory_order_relaxed);
+        if (from >= FrontierLen) break;
+        size_t to = from + CHUNK_LEN < FrontierLen ? from + CHUNK_LEN : FrontierLen;
+        for (size_t i = from; i < to; ++i)
+            Expand(self, Frontier[i]);
+    }
+    if (self->outbox_len) Flush(self);
+}
+
+void *WorkerMain(void *arg)
+{
+    struct Worker *self = arg;
+
+    for (;;)
+    {
+        pthread_barrier_wait(&Barrier); // main has set up the level
+        if (Done) break;
+
+        ExpandLevel(self);
+        pthread_barrier_wait(&Barrier); // level done
+    }
+    return NULL;
+}
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void PrintExample(uint64_t key)
+{
+    struct VNPU vm;
+    Unpack(key, &vm);
+    printf("e.g.");
+    for (int i = 0; i < PackedLen; ++i)
+        printf(" %cX=%llu", 'A' + Packed[i], (unsigned long long)vm.R[Packed[i]][0]);
+    printf(" MEM=%llu,%llu", (unsigned long long)vm.MEM[0][0], (unsigned long long)vm.MEM[1][0]);
+}
+
+void printExploreUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-explore [-j THREADS] [-a] [-b] [-M STATES] PROGRAM\n"
+        "  -j THREADS  worker threads ( default: one per online core )\n"
+        "  -a          start from every AX value instead of just 0\n"
+        "  -b          start from every BX value instead of just 0\n"
+        "  -M STATES   most distinct states one level may hold ( default: 4194304 )\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool any_ax = false, any_bx = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:abM:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                any_ax = true;
+                break;
+            case 'b':
+                any_bx = true;
+                break;
+            case 'M':
+                MaxStates = (size_t)strtoull(optarg, NULL, 10);
+                break;
+            default:
+                printExploreUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || threads < 1 || MaxStates < 1)
+    {
+        printExploreUsage();
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    if (!VnpuLoadFile(&Prog, path))
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", path);
+        return 1;
+    }
+    if (!PickRegisters(&Prog))
+    {
+        fprintf(stderr, "VNPU => ERROR: \"%s\" is too long to explore with %d registers in use.\n",
+                path, PackedLen);
+        return 1;
+    }
+
+    Stats = calloc(Prog.len ? Prog.len : 1, sizeof *Stats);
+    size_t initial = (any_ax ? 256 : 1) * (any_bx ? 256 : 1);
+    if (initial > MaxStates) MaxStates = initial;
+    Frontier = malloc(MaxStates * sizeof *Frontier);
+    NextFrontier = malloc(MaxStates * sizeof *NextFrontier);
+    WorkerCount = (int)threads;
+    Workers = aligned_alloc(CACHE_LINE, (size_t)WorkerCount * sizeof *Workers);
+    if (!Stats || !Frontier || !NextFrontier || !Workers)
+    {
+        fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+        return 1;
+    }
+    memset(Workers, 0, (size_t)WorkerCount * sizeof *Workers);
+
+    // level 0: every initial state, all different already
+    FrontierLen = 0;
+    for (unsigned a = 0; a < (any_ax ? 256u : 1u); ++a)
+        for (unsigned b = 0; b < (any_bx ? 256u : 1u); ++b)
+        {
+            struct VNPU vm;
+            VnpuReset(&vm, NULL);
+            vm.AX[0] = a;
+            vm.BX[0] = b;
+            Frontier[FrontierLen++] = Pack(&vm);
+        }
+
+    double start = NowSec();
+    unsigned long long explored = 0;
+    pthread_barrier_init(&Barrier, NULL, (unsigned)WorkerCount);
+    for (int i = 0; i < WorkerCount; ++i)
+    {
+        Workers[i].id = i;
+        if (i > 0) pthread_create(&Workers[i].thread, NULL, WorkerMain, &Workers[i]);
+    }
+
+    // Worker 0 is us: set a level up, expand our share, swap, repeat
+    for (Level = 0; Level < Prog.len && FrontierLen > 0; ++Level)
+    {
+        const struct VnpuOp *op = &Prog.ops[Level];
+        size_t fanout = op->kind == VNPU_OP_EXEC && op->instr == 'I' ? 256 : 1;
+        size_t expected = FrontierLen > MaxStates / fanout ? MaxStates : FrontierLen * fanout;
+        if (!SetInit(&NextSet, expected, MaxStates))
+        {
+            fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+            return 1;
+        }
+        Stats[Level].reached = FrontierLen;
+        explored += FrontierLen;
+        atomic_store(&FrontierNext, 0);
+        atomic_store(&NextLen, 0);
+
+        pthread_barrier_wait(&Barrier);
+        ExpandLevel(&Workers[0]);
+        pthread_barrier_wait(&Barrier);
+
+        SetFree(&NextSet);
+        uint64_t *swap = Frontier;
+        Frontier = NextFrontier;
+        NextFrontier = swap;
+        FrontierLen = atomic_load(&NextLen);
+    }
+    Done = true;
+    pthread_barrier_wait(&Barrier);
+    for (int i = 1; i < WorkerCount; ++i)
+        pthread_join(Workers[i].thread, NULL);
+    double elapsed = NowSec() - start;
+
+    // the report, in program order
+    size_t faulty = 0;
+    for (size_t pc = 0; pc < Prog.len; ++pc)
+    {
+        struct OpStats *st = &Stats[pc];
+        char text[8];
+        VnpuFormatOp(&Prog.ops[pc], text);
+
+        if (st->reached == 0)
+        {
+            size_t last = pc;
+            while (last + 1 < Prog.len && Stats[last + 1].reached == 0) last++;
+            if (Prog.ops[last].line != Prog.ops[pc].line)
+                printf("%s:%d-%d: unreachable ( %zu ops )\n", path, Prog.ops[pc].line, Prog.ops[last].line, last - pc + 1);
+            else
+                printf("%s:%d: %s: unreachable\n", path, Prog.ops[pc].line, text);
+            break; // no jumps: everything after it is unreachable too
+        }
+
+        unsigned long long divzero = atomic_load(&st->divzero);
+        unsigned long long illegal = atomic_load(&st->illegal);
+        if (divzero)
+        {
+            printf("%s:%d: %s: division by zero from %llu of %llu states, ",
+                   path, Prog.ops[pc].line, text, divzero, st->reached);
+            PrintExample(atomic_load(&st->divzero_example));
+            printf("\n");
+            faulty++;
+        }
+        if (illegal)
+        {
+            printf("%s:%d: %s: illegal instruction from %llu of %llu states, ",
+                   path, Prog.ops[pc].line, text, illegal, st->reached);
+            PrintExample(atomic_load(&st->illegal_example));
+            printf("\n");
+            faulty++;
+        }
+    }
+
+    fflush(stdout);
+    bool overflow = atomic_load(&Overflow);
+    int status = faulty ? 2 : overflow ? 3 : 0;
+    fprintf(stderr, "VNPU => %s: %zu ops, %zu initial states, %llu states in %.3f s, %d threads.\n",
+            path, Prog.len, initial, explored, elapsed, WorkerCount);
+    if (overflow)
+        fprintf(stderr, "VNPU => %s: some level had more than %zu states, not everything was explored.\n", path, MaxStates);
+    fprintf(stderr, "VNPU => %s: %s.\n", path,
+            faulty ? "UNSAFE" : overflow ? "UNKNOWN" : "SAFE");
+
+    pthread_barrier_destroy(&Barrier);
+    free(Frontier);
+    free(NextFrontier);
+    free(Workers);
+    free(Stats);
+    VnpuFree(&Prog);
+    return status;
+}
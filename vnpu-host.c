@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "ports.h"
+
+/*
+	vnpu-host
+	- The other end of the shared-memory I/O ports, for trying them out
+	  locally: creates the object, feeds 0, 1, ... COUNT-1 into one input
+	  port, closes it, and drains the matching output port until the
+	  VNPU closes it ( or until the VNPU's process is gone ).
+	- Given a command after '--' it runs it as the VNPU, e.g.
+	      vnpu-host -n 100 /vnpu0 -- ./vnpu-run -P /vnpu0 examples/double.vnis
+	  otherwise it waits for someone to attach by hand.
+	- The values that come back go to stdout one per line ( -q to skip
+	  them ), how many and how fast goes to stderr.
+	- The object is unlinked on the way out.
+*/
+
+extern char **environ;
+
+struct Feeder
+{
+    struct VnpuRingEnd end;
+    unsigned long long count;
+    atomic_bool stop; // the VNPU is done, nobody will read the rest
+};
+
+// FeedMain ( void *arg )
+// ⤷ Feeder thread: pushes 0 .. count-1, then closes the ring
+void *FeedMain(void *arg);
+
+// ChildGone ( pid_t pid )
+// ⤷ True once the spawned VNPU has exited ( always false without one )
+bool ChildGone(pid_t pid);
+
+void printHostUsage(void);
+
+void *FeedMain(void *arg)
+{
+    struct Feeder *fd = arg;
+    for (unsigned long long i = 0; i < fd->count; ++i)
+    {
+        unsigned spins = 0;
+        while (RingTryPush(&fd->end, i) == VNPU_PORT_BLOCKED)
+        {
+            if (atomic_load_explicit(&fd->stop, memory_order_relaxed))
+                goto done;
+            PortBackoff(&spins);
+        }
+    }
+done:
+    RingClose(&fd->end);
+    return NULL;
+}
+
+static int ChildStatus = -1;
+
+bool ChildGone(pid_t pid)
+{
+    if (pid <= 0) return false;
+    if (ChildStatus >= 0) return true;
+
+    int st;
+    if (waitpid(pid, &st, WNOHANG) != pid) return false;
+    ChildStatus = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+    return true;
+}
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void printHostUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-host [-n COUNT] [-p PORT] [-q] SHM [-- COMMAND [ARGS...]]\n"
+        "  -n COUNT  feed 0 .. COUNT-1 into the input port ( default: 16 )\n"
+        "  -p PORT   which input / output port pair to use ( default: 0 )\n"
+        "  -q        don't print the values that come back\n"
+        "  SHM       name of the shared-memory object to create, e.g. /vnpu0\n"
+        "  COMMAND   run this as the VNPU, otherwise wait for one to attach\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long count = 16;
+    long port = 0;
+    bool quiet = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+n:p:qh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                count = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                port = strtol(optarg, NULL, 10);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                printHostUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc || port < 0 || port >= VNPU_PORT_COUNT)
+    {
+        printHostUsage();
+        return 1;
+    }
+    const char *name = argv[optind++];
+    if (optind < argc && strcmp(argv[optind], "--") == 0)
+        optind++;
+    char **command = optind < argc ? &argv[optind] : NULL;
+
+    struct VnpuShm *shm = VnpuShmCreate(name);
+    if (!shm)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot create \"%s\".\n", name);
+        return 1;
+    }
+
+    struct Feeder feeder;
+    RingEndInit(&feeder.end, &shm->in[port], true);
+    feeder.count = count;
+    atomic_init(&feeder.stop, false);
+
+    struct VnpuRingEnd drain;
+    RingEndInit(&drain, &shm->out[port], false);
+
+    double start = NowSec();
+    pthread_t feed_thread;
+    if (pthread_create(&feed_thread, NULL, FeedMain, &feeder) != 0)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot start the feeder.\n");
+        VnpuShmDetach(shm);
+        shm_unlink(name);
+        return 1;
+    }
+
+    pid_t pid = 0;
+    if (command)
+    {
+        if (posix_spawnp(&pid, command[0], NULL, NULL, command, environ) != 0)
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot run \"%s\".\n", command[0]);
+            pid = 0;
+            // nobody will close the output port, do it for them
+            RingClose(&(struct VnpuRingEnd){ .ring = &shm->out[port] });
+        }
+    }
+    else
+        fprintf(stderr, "VNPU => waiting on \"%s\", port %ld.\n", name, port);
+
+    unsigned long long received = 0, sum = 0;
+    for (;;)
+    {
+        uint64_t val;
+        unsigned spins = 0;
+        int status;
+        while ((status = RingTryPop(&drain, &val)) == VNPU_PORT_BLOCKED)
+        {
+            // a VNPU that died never closes its ports; one last look and give up
+            if (ChildGone(pid))
+            {
+                status = RingTryPop(&drain, &val);
+                if (status == VNPU_PORT_BLOCKED) status = VNPU_PORT_CLOSED;
+                break;
+            }
+            PortBackoff(&spins);
+        }
+        if (status == VNPU_PORT_CLOSED) break;
+
+        received++;
+        sum += val;
+        if (!quiet) printf("%llu\n", (unsigned long long)val);
+    }
+    double elapsed = NowSec() - start;
+
+    atomic_store_explicit(&feeder.stop, true, memory_order_relaxed);
+    pthread_join(feed_thread, NULL);
+
+    int status = 0;
+    if (pid > 0)
+    {
+        while (!ChildGone(pid))
+        {
+            struct timespec nap = { 0, 1000000 };
+            nanosleep(&nap, NULL);
+        }
+        status = ChildStatus;
+    }
+
+    fprintf(stderr, "VNPU => %llu values offered, %llu values back ( sum %llu ) in %.3f s, %.0f values/s.\n",
+            count, received, sum, elapsed, elapsed > 0 ? (double)received / elapsed : 0.0);
+
+    VnpuShmDetach(shm);
+    shm_unlink(name);
+    return status;
+}
@@ -0,0 +1,592 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vnpu.h"
+#include "ports.h"
+
+/*
+	vnpu-net
+	- Runs a dataflow network of VNPUs declared in a topology file:
+	      node NAME PROGRAM           ( relative to the topology file )
+	      link SRC[:PORT] DST[:PORT]  # '#' starts a comment
+	  A link carries words from SRC's output port PORT ( '0'..'3' for
+	  'O', '@' for what '@ A' / '@ B' print, the default ) to DST's
+	  input port PORT ( default '0' ), where 'I' reads them.
+	- Links are bounded lock-free single-producer / single-consumer
+	  rings ( the ones from ports.h ). A VNPU that finds its input empty
+	  or its output full doesn't spin: VnpuRun() hands it back in front
+	  of that op, and it sleeps until the other end has moved.
+	- Every VNPU is a task on a pool of threads. A task is IDLE ( waiting
+	  on a link ), QUEUED, RUNNING, or NOTIFIED ( running, and something
+	  it may be waiting on has moved since ); a notification only ever
+	  queues an IDLE task, so no task is on two threads at once, and one
+	  that arrives while the task is still running is never lost. A ring
+	  end only bothers the other side when that side said it is waiting.
+	- A VNPU that halts closes its outputs ( downstream 'I' then halts
+	  once it has read everything, "input closed" ) and drops its inputs
+	  ( upstream writes to them go nowhere ). Unlinked inputs are closed,
+	  unlinked outputs go nowhere, unrouted prints go to stdout, per
+	  node, in declaration order once the network is done.
+	- If every thread is out of work while some VNPU still waits, the
+	  network is deadlocked: those VNPUs are reported and the exit code
+	  is 7. Otherwise it's the one of the first VNPU that didn't halt
+	  cleanly, see VnpuExitCode().
+	- VNPUs are not preempted: one that runs a long stretch without
+	  touching a link keeps its thread until it does.
+*/
+
+#define CACHE_LINE 64
+#define NAME_LEN 32
+#define EXIT_DEADLOCK 7
+
+enum TaskState
+{
+    TASK_IDLE = 0,
+    TASK_QUEUED,
+    TASK_RUNNING,
+    TASK_NOTIFIED,
+    TASK_DONE
+};
+
+struct Node;
+
+struct Link
+{
+    struct VnpuRing *ring;
+    struct VnpuRingEnd tx; // only touched by whoever runs 'src'
+    struct VnpuRingEnd rx; // only touched by whoever runs 'dst'
+    struct Node *src, *dst;
+    size_t src_index, dst_index; // while Nodes[] may still move
+    int src_port, dst_port;
+
+    _Alignas(CACHE_LINE) atomic_bool rx_waiting; // dst found it empty
+    _Alignas(CACHE_LINE) atomic_bool tx_waiting; // src found it full
+    atomic_bool dropped;                         // dst has halted
+};
+
+struct Node
+{
+    _Alignas(CACHE_LINE) atomic_int state; // enum TaskState
+    char name[NAME_LEN];
+    char *path;
+    struct VnpuProgram prog;
+    struct VNPU vm;
+    struct VnpuPortOps ops;
+    struct Link *in[VNPU_PORT_COUNT];
+    struct Link *out[VNPU_PORT_COUNT + 1]; // + VNPU_PORT_PRINT
+    char *output;
+    size_t output_len;
+    FILE *out_file;
+    struct Node *next_queued;
+    unsigned long long runs; // how many times it got a thread
+};
+
+struct Node *Nodes;
+size_t NodeCount;
+struct Link *Links;
+size_t LinkCount;
+bool Verbose = false;
+
+// The run queue: a FIFO of QUEUED nodes
+pthread_mutex_t QueueLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t QueueCond = PTHREAD_COND_INITIALIZER;
+struct Node *QueueHead, *QueueTail;
+int IdleWorkers;
+int WorkerCount;
+bool Finished = false;
+
+// LoadTopology ( const char *path )
+// ⤷ Fills Nodes[] and Links[] from a topology file. Returns false on error,
+//   having said why.
+bool LoadTopology(const char *path);
+
+// Notify ( struct Node *node )
+// ⤷ Something 'node' may be waiting on has moved: queue it if it is IDLE,
+//   tell it to look again if it is RUNNING
+void Notify(struct Node *node);
+
+// RunNode ( struct Node *node )
+// ⤷ Gives 'node' a thread until it halts or has to wait
+void RunNode(struct Node *node);
+
+void *WorkerMain(void *arg);
+void printNetUsage(void);
+
+static void Enqueue(struct Node *node)
+{
+    pthread_mutex_lock(&QueueLock);
+    node->next_queued = NULL;
+    if (QueueTail) QueueTail->next_queued = node;
+    else QueueHead = node;
+    QueueTail = node;
+    pthread_cond_signal(&QueueCond);
+    pthread_mutex_unlock(&QueueLock);
+}
+
+void Notify(struct Node *node)
+{
+    int s = atomic_load(&node->state);
+    for (;;)
+    {
+        if (s == TASK_IDLE)
+        {
+            if (atomic_compare_exchange_weak(&node->state, &s, TASK_QUEUED))
+            {
+                Enqueue(node);
+                return;
+            }
+        }
+        else if (s == TASK_RUNNING)
+        {
+            if (atomic_compare_exchange_weak(&node->state, &s, TASK_NOTIFIED))
+                return;
+        }
+        else
+            return; // QUEUED or NOTIFIED already, or DONE
+    }
+}
+
+// LinkIn / LinkOut ( void *ctx, int port, ... )
+// ⤷ struct VnpuPortOps of a node: never wait, say VNPU_PORT_BLOCKED instead
+static int LinkIn(void *ctx, int port, uint64_t *val)
+{
+    struct Node *node = ctx;
+    struct Link *l = node->in[port];
+    if (!l) return VNPU_PORT_CLOSED;
+
+    int status = RingTryPop(&l->rx, val);
+    if (status == VNPU_PORT_BLOCKED)
+    {
+        // say we're waiting, then look again in case src pushed in between
+        atomic_store(&l->rx_waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        status = RingTryPop(&l->rx, val);
+    }
+    if (status == VNPU_PORT_OK)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&l->tx_waiting, memory_order_relaxed))
+        {
+            atomic_store(&l->tx_waiting, false);
+            Notify(l->src);
+        }
+    }
+    return status;
+}
+
+static int LinkOut(void *ctx, int port, uint64_t val)
+{
+    struct Node *node = ctx;
+    struct Link *l = node->out[port];
+    if (!l || atomic_load_explicit(&l->dropped, memory_order_acquire))
+        return VNPU_PORT_OK; // nobody listens
+
+    int status = RingTryPush(&l->tx, val);
+    if (status == VNPU_PORT_BLOCKED)
+    {
+        atomic_store(&l->tx_waiting, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        status = RingTryPush(&l->tx, val);
+    }
+    if (status == VNPU_PORT_OK)
+    {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&l->rx_waiting, memory_order_relaxed))
+        {
+            atomic_store(&l->rx_waiting, false);
+            Notify(l->dst);
+        }
+    }
+    return status;
+}
+
+void RunNode(struct Node *node)
+{
+    node->runs++;
+    for (;;)
+    {
+        VnpuRun(&node->vm, &node->prog);
+
+        if (node->vm.HALT || node->vm.pc >= node->prog.len)
+        {
+            atomic_store(&node->state, TASK_DONE);
+            for (int p = 0; p <= VNPU_PORT_COUNT; ++p)
+                if (node->out[p])
+                {
+                    RingClose(&node->out[p]->tx);
+                    Notify(node->out[p]->dst);
+                }
+            for (int p = 0; p < VNPU_PORT_COUNT; ++p)
+                if (node->in[p])
+                {
+                    atomic_store(&node->in[p]->dropped, true);
+                    Notify(node->in[p]->src);
+                }
+            return;
+        }
+
+        // waiting on a link: go to sleep, unless it already moved
+        int s = TASK_RUNNING;
+        if (atomic_compare_exchange_strong(&node->state, &s, TASK_IDLE))
+            return;
+        atomic_store(&node->state, TASK_RUNNING); // NOTIFIED: look again
+    }
+}
+
+void *WorkerMain(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&QueueLock);
+        while (!QueueHead && !Finished)
+        {
+            // the last thread to run dry with nothing queued turns the lights off
+            if (++IdleWorkers == WorkerCount)
+            {
+                Finished = true;
+                pthread_cond_broadcast(&QueueCond);
+                break;
+            }
+            pthread_cond_wait(&QueueCond, &QueueLock);
+            IdleWorkers--;
+        }
+        if (Finished && !QueueHead)
+        {
+            pthread_mutex_unlock(&QueueLock);
+            return NULL;
+        }
+        struct Node *node = QueueHead;
+        QueueHead = node->next_queued;
+        if (!QueueHead) QueueTail = NULL;
+        pthread_mutex_unlock(&QueueLock);
+
+        atomic_store(&node->state, TASK_RUNNING);
+        RunNode(node);
+    }
+}
+
+// GrowAligned ( void *old, size_t len, size_t cap, size_t size )
+// ⤷ realloc() for the CACHE_LINE-aligned Nodes[] and Links[]: room for 'cap'
+//   entries of 'size' bytes, the first 'len' copied over. NULL on failure,
+//   'old' is left as it was then.
+static void *GrowAligned(void *old, size_t len, size_t cap, size_t size)
+{
+    void *grown = aligned_alloc(CACHE_LINE, cap * size);
+    if (!grown) return NULL;
+    if (len) memcpy(grown, old, len * size);
+    free(old);
+    return grown;
+}
+
+static struct Node *FindNode(const char *name)
+{
+    for (size_t i = 0; i < NodeCount; ++i)
+        if (strcmp(Nodes[i].name, name) == 0)
+            return &Nodes[i];
+    return NULL;
+}
+
+// ParseEnd ( char *spec, char def, size_t *node, int *port, bool out )
+// ⤷ "NAME" or "NAME:PORT" of a link
+static bool ParseEnd(char *spec, char def, size_t *node, int *port, bool out)
+{
+    char *colon = strchr(spec, ':');
+    char p = def;
+    if (colon)
+    {
+        *colon = '\0';
+        if (strlen(colon + 1) != 1) return false;
+        p = colon[1];
+    }
+
+    struct Node *found = FindNode(spec);
+    if (!found) return false;
+    *node = (size_t)(found - Nodes);
+    if (out && p == '@')
+        *port = VNPU_PORT_PRINT;
+    else if (p >= '0' && p < '0' + VNPU_PORT_COUNT)
+        *port = p - '0';
+    else
+        return false;
+    return true;
+}
+
+bool LoadTopology(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot open \"%s\".\n", path);
+        return false;
+    }
+
+    // programs are relative to the topology file itself
+    char dir[4096];
+    snprintf(dir, sizeof dir, "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = '\0';
+
+    char *line = NULL;
+    size_t cap = 0, node_cap = 0, link_cap = 0;
+    int lineno = 0;
+    bool ok = true;
+
+    while (ok && getline(&line, &cap, f) != -1)
+    {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *words[4];
+        int n = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"))
+        {
+            if (n == 4) { n++; break; }
+            words[n++] = tok;
+        }
+        if (n == 0) continue;
+
+        if (n == 3 && strcmp(words[0], "node") == 0)
+        {
+            if (strlen(words[1]) >= NAME_LEN || FindNode(words[1]))
+            {
+                fprintf(stderr, "VNPU => ERROR: %s:%d: bad or duplicate node name \"%s\".\n", path, lineno, words[1]);
+                ok = false;
+                break;
+            }
+            if (NodeCount == node_cap)
+            {
+                node_cap = node_cap ? node_cap * 2 : 8;
+                struct Node *grown = GrowAligned(Nodes, NodeCount, node_cap, sizeof *grown);
+                if (!grown) { ok = false; break; }
+                Nodes = grown;
+            }
+            struct Node *node = &Nodes[NodeCount];
+            memset(node, 0, sizeof *node);
+            snprintf(node->name, sizeof node->name, "%s", words[1]);
+
+            size_t len = strlen(words[2]) + strlen(dir) + 2;
+            node->path = malloc(len);
+            if (!node->path) { ok = false; break; }
+            if (words[2][0] != '/' && slash)
+                snprintf(node->path, len, "%s/%s", dir, words[2]);
+            else
+                snprintf(node->path, len, "%s", words[2]);
+            NodeCount++;
+        }
+        else if (n == 3 && strcmp(words[0], "link") == 0)
+        {
+            if (LinkCount == link_cap)
+            {
+                link_cap = link_cap ? link_cap * 2 : 8;
+                struct Link *grown = GrowAligned(Links, LinkCount, link_cap, sizeof *grown);
+                if (!grown) { ok = false; break; }
+                Links = grown;
+            }
+            struct Link *l = &Links[LinkCount];
+            memset(l, 0, sizeof *l);
+            if (!ParseEnd(words[1], '@', &l->src_index, &l->src_port, true) ||
+                !ParseEnd(words[2], '0', &l->dst_index, &l->dst_port, false))
+            {
+                fprintf(stderr, "VNPU => ERROR: %s:%d: bad link ( unknown node or port ).\n", path, lineno);
+                ok = false;
+                break;
+            }
+            // one producer and one consumer per ring
+            for (size_t i = 0; i < LinkCount; ++i)
+                if ((Links[i].src_index == l->src_index && Links[i].src_port == l->src_port) ||
+                    (Links[i].dst_index == l->dst_index && Links[i].dst_port == l->dst_port))
+                    ok = false;
+            if (!ok)
+            {
+                fprintf(stderr, "VNPU => ERROR: %s:%d: port already linked.\n", path, lineno);
+                break;
+            }
+            LinkCount++;
+        }
+        else
+        {
+            fprintf(stderr, "VNPU => ERROR: %s:%d: expected \"node NAME PROGRAM\" or \"link SRC DST\".\n", path, lineno);
+            ok = false;
+        }
+    }
+    free(line);
+    fclose(f);
+    if (!ok) return false;
+    if (NodeCount == 0)
+    {
+        fprintf(stderr, "VNPU => ERROR: \"%s\" has no nodes.\n", path);
+        return false;
+    }
+
+    // now that nothing moves any more, wire it all up
+    for (size_t i = 0; i < LinkCount; ++i)
+    {
+        struct Link *l = &Links[i];
+        l->src = &Nodes[l->src_index];
+        l->dst = &Nodes[l->dst_index];
+        l->src->out[l->src_port] = l;
+        l->dst->in[l->dst_port] = l;
+    }
+    return true;
+}
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void printNetUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-net [-j THREADS] [-v] TOPOLOGY\n"
+        "  -j THREADS  worker threads ( default: one per online core )\n"
+        "  -v          print a '==> node <==' header before each node's output,\n"
+        "              why each node stopped and how the network did on stderr\n"
+        "TOPOLOGY lines:\n"
+        "  node NAME PROGRAM\n"
+        "  link SRC[:PORT] DST[:PORT]   SRC port '@' ( default ) or '0'..'3',\n"
+        "                               DST port '0' ( default ) .. '3'\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'v':
+                Verbose = true;
+                break;
+            default:
+                printNetUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || threads < 1)
+    {
+        printNetUsage();
+        return 1;
+    }
+    if (!LoadTopology(argv[optind]))
+        return 1;
+
+    for (size_t i = 0; i < LinkCount; ++i)
+    {
+        struct Link *l = &Links[i];
+        l->ring = aligned_alloc(CACHE_LINE, sizeof *l->ring);
+        if (!l->ring)
+        {
+            fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+            return 1;
+        }
+        atomic_init(&l->ring->head, 0);
+        atomic_init(&l->ring->tail, 0);
+        atomic_init(&l->ring->closed, 0);
+        RingEndInit(&l->tx, l->ring, true);
+        RingEndInit(&l->rx, l->ring, false);
+        atomic_init(&l->rx_waiting, false);
+        atomic_init(&l->tx_waiting, false);
+        atomic_init(&l->dropped, false);
+    }
+
+    for (size_t i = 0; i < NodeCount; ++i)
+    {
+        struct Node *node = &Nodes[i];
+        if (!VnpuLoadFile(&node->prog, node->path))
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", node->path);
+            return 1;
+        }
+        node->out_file = open_memstream(&node->output, &node->output_len);
+        if (!node->out_file) return 1;
+
+        VnpuReset(&node->vm, node->out_file);
+        node->ops.In = LinkIn;
+        node->ops.Out = LinkOut;
+        node->ops.ctx = node;
+        node->ops.print_out = node->out[VNPU_PORT_PRINT] != NULL;
+        node->vm.ports = &node->ops;
+        atomic_init(&node->state, TASK_QUEUED);
+        Enqueue(node);
+    }
+
+    WorkerCount = (int)threads;
+    pthread_t *workers = calloc((size_t)WorkerCount, sizeof *workers);
+    if (!workers) return 1;
+
+    double start = NowSec();
+    for (int i = 1; i < WorkerCount; ++i)
+        pthread_create(&workers[i], NULL, WorkerMain, NULL);
+    WorkerMain(NULL);
+    for (int i = 1; i < WorkerCount; ++i)
+        pthread_join(workers[i], NULL);
+    double elapsed = NowSec() - start;
+
+    int status = 0;
+    size_t stuck = 0;
+    unsigned long long insns = 0, runs = 0;
+    for (size_t i = 0; i < NodeCount; ++i)
+    {
+        struct Node *node = &Nodes[i];
+        fclose(node->out_file);
+        if (Verbose)
+            printf("==> %s <==\n", node->name);
+        fwrite(node->output, 1, node->output_len, stdout);
+        insns += node->vm.insns;
+        runs += node->runs;
+
+        if (atomic_load(&node->state) != TASK_DONE)
+        {
+            const struct VnpuOp *op = &node->prog.ops[node->vm.pc];
+            char text[8];
+            VnpuFormatOp(op, text);
+            fprintf(stderr, "VNPU => %s: deadlocked at %s:%d: %s.\n", node->name, node->path, op->line, text);
+            stuck++;
+            if (status == 0) status = EXIT_DEADLOCK;
+        }
+        else
+        {
+            enum VnpuHalt reason = node->vm.HALT ? node->vm.HaltReason : VNPU_HALT_EOF;
+            int code = VnpuExitCode(reason);
+            if (code != 0 && status == 0) status = code;
+            if (Verbose)
+                fprintf(stderr, "VNPU => %s: %s after %llu instructions.\n", node->name, VnpuHaltName(reason), node->vm.insns);
+        }
+    }
+
+    if (Verbose)
+        fprintf(stderr, "VNPU => %zu nodes, %zu links, %llu instructions, %llu runs in %.3f s ( %.0f instructions/s ), %d threads.\n",
+                NodeCount, LinkCount, insns, runs, elapsed, elapsed > 0 ? (double)insns / elapsed : 0.0, WorkerCount);
+
+    for (size_t i = 0; i < NodeCount; ++i)
+    {
+        free(Nodes[i].output);
+        free(Nodes[i].path);
+        VnpuFree(&Nodes[i].prog);
+    }
+    for (size_t i = 0; i < LinkCount; ++i)
+        free(Links[i].ring);
+    free(Links);
+    free(Nodes);
+    free(workers);
+    return status;
+}
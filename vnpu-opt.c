@@ -0,0 +1,952 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vnpu.h"
+
+#if VNPU_WORD_SIZE != 8
+#error "vnpu-opt checks 8-bit machines only"
+#endif
+
+/*
+	vnpu-opt
+	- A superoptimizer: finds the shortest sequence of ops that does
+	  exactly what a straight run of a program's ops does, and writes the
+	  program back out with it. Every op it removes is one 337 ms cycle
+	  and one dispatch less.
+	- Only the ops without side effects are touched: + - * / M and the
+	  comparisons that come out false ( they do nothing ). Everything
+	  else ( '@', 'I', 'O', 'H', '.', illegal ops, lines that aren't
+	  exactly "X Y Z" or "X Y Z D", any register past BX ) splits the
+	  program into windows and is left alone, byte for byte.
+	- Candidates are made of 'M', two-operand arithmetic ( into AX ) and
+	  three-operand arithmetic into BX, so a result that was only moved
+	  to BX afterwards can go there directly.
+	- A window is taken WINDOW ops at a time. For each stretch, the
+	  candidates are enumerated shortest first, up to MAXLEN ops:
+	      - run over 64 sample ( AX, BX ) pairs at once, as lanes of
+	        bytes the compiler can vectorize,
+	      - pruned as soon as a prefix halts where it mustn't or leaves
+	        more registers wrong than ops remain to fix them ( an op
+	        writes AX or BX, never both ),
+	      - and split over every core by their first op.
+	  A candidate that matches on every lane is then run through the
+	  real machine ( VnpuStep() ) from all 65536 ( AX, BX ) pairs, and
+	  twice each to tell MEM being written from MEM being left alone,
+	  and only replaces the original if it matches everywhere: same
+	  halts, same AX, BX and MEM. Inputs a candidate got wrong there are
+	  tried first on the next one.
+	- -L relaxes "same" to what the rest of the program can still see:
+	  MEM is never read by any op, a register that is overwritten before
+	  it is read again is dead.
+	- The first candidate in a fixed order wins, so the output doesn't
+	  depend on -j.
+*/
+
+// Sample ( AX, BX ) pairs a candidate is run on before being checked for real
+#define LANES 64
+// Longest candidate that can be asked for
+#define MAX_SEQ 6
+// Inputs a target remembers candidates failing on
+#define CEX_LEN 64
+// Bytes a search is remembered by, for a window of 16 ops at most ( see -w )
+#define KEY_LEN (4 * 16 + 8)
+
+// What a stretch of ops may not change: LIVE_A / LIVE_B the registers, LIVE_M
+// MEM ( and whether it was written at all )
+#define LIVE_A 1
+#define LIVE_B 2
+#define LIVE_M 4
+#define LIVE_ALL (LIVE_A | LIVE_B | LIVE_M)
+
+// Every register, MEM word and halt flag over the sample lanes
+struct Lanes
+{
+    uint8_t ax[LANES];
+    uint8_t bx[LANES];
+    uint8_t m0[LANES];
+    uint8_t m1[LANES];
+    uint8_t halt[LANES]; // 0xff once halted
+    bool wrote;          // MEM was written ( on every lane that didn't halt )
+};
+
+// One pair of initial registers, exactly, through VnpuStep(): MEM from two
+// different starts, so MEM left alone shows up as two different results
+struct Exact
+{
+    uint8_t ax;
+    uint8_t bx;
+    uint8_t mem[2][2];
+    uint8_t reason;
+};
+
+// A stretch of ops to find something shorter for
+struct Target
+{
+    const struct VnpuOp *ops;
+    size_t len;
+    int live;
+    struct Lanes lanes; // what it does to the samples
+    uint8_t la, lb, lm; // 0xff where live
+    struct Exact *exact; // every input, made the first time a candidate needs it
+    pthread_mutex_t lock;
+    uint16_t cex[CEX_LEN]; // inputs earlier candidates got wrong, tried first
+    atomic_int cex_len;
+};
+
+struct Search
+{
+    struct Target *t;
+    int len;
+    atomic_size_t next;  // next first op to claim
+    atomic_size_t best;  // lowest first op with a match, Alphabet len for none
+    struct VnpuOp (*found)[MAX_SEQ]; // per first op
+};
+
+// SETTINGS ( set once in main() )
+static long Threads = 1;
+static int MaxLen = 3;
+static int Window = 8;
+static bool Liveness = false;
+static bool Quiet = false;
+
+// Every op a candidate can be made of, in the order they're tried
+static struct VnpuOp Alphabet[1024];
+static size_t AlphabetLen;
+static struct Lanes Start;        // the samples
+static uint8_t Digits[10][LANES]; // immediates, one per lane
+
+// Failed searches, so a window that changed doesn't search its untouched stretches again
+static char **Failed;
+static size_t FailedLen, FailedCap;
+
+// The program as text, and where each of its lines starts
+static char *Text;
+static size_t TextLen;
+static size_t *LineAt; // LineCount + 1 entries, the last one is TextLen
+static size_t LineCount;
+
+// Build ( void )
+// ⤷ Fills Alphabet[], Start and Digits[]
+void Build(void);
+
+// Pure ( const struct VnpuOp *op )
+// ⤷ True for the ops vnpu-opt may move around: no I/O, no output, the same
+//   thing from the same registers every time
+bool Pure(const struct VnpuOp *op);
+
+// Apply ( const struct Lanes *in, struct Lanes *out, const struct VnpuOp *op )
+// ⤷ One pure op over every lane
+void Apply(const struct Lanes *in, struct Lanes *out, const struct VnpuOp *op);
+
+// LiveBefore ( const struct VnpuOp *op, int live )
+// ⤷ What has to be right before 'op' for what's live after it to come out right
+int LiveBefore(const struct VnpuOp *op, int live);
+
+// Shortest ( struct Target *t, int max, struct VnpuOp out[MAX_SEQ] )
+// ⤷ Length of the shortest sequence equivalent to 't', -1 if none is at most 'max' ops
+int Shortest(struct Target *t, int max, struct VnpuOp out[MAX_SEQ]);
+
+// Optimize ( struct VnpuOp *ops, size_t *len, int *lines, int live_out, const char *name )
+// ⤷ Rewrites one window in place, shrinking stretches until none shrinks
+void Optimize(struct VnpuOp *ops, size_t *len, int *lines, int live_out, const char *name);
+
+void printOptUsage(void);
+
+static struct VnpuOp MakeOp(char instr, char com1, char com2, char com3)
+{
+    struct VnpuOp op = { VNPU_OP_EXEC, instr, com1, com2, com3, 0 };
+    return op;
+}
+
+void Build(void)
+{
+    static const char operands[] = "AB0123456789";
+    static const char arith[] = "+-*/";
+    static const char dests[] = { '\0', 'B' };
+
+    AlphabetLen = 0;
+    Alphabet[AlphabetLen++] = MakeOp('M', 'A', 'B', '\0');
+    Alphabet[AlphabetLen++] = MakeOp('M', 'B', 'A', '\0');
+    for (char d = '0'; d <= '9'; ++d)
+    {
+        Alphabet[AlphabetLen++] = MakeOp('M', d, 'A', '\0');
+        Alphabet[AlphabetLen++] = MakeOp('M', d, 'B', '\0');
+    }
+    // into AX, then the same into BX
+    for (size_t d = 0; d < sizeof dests; ++d)
+        for (const char *i = arith; *i; ++i)
+            for (size_t x = 0; x < sizeof operands - 1; ++x)
+                for (size_t y = 0; y < sizeof operands - 1; ++y)
+                {
+                    // + and * commute, one order is enough
+                    if ((*i == '+' || *i == '*') && y < x) continue;
+                    Alphabet[AlphabetLen++] = MakeOp(*i, operands[x], operands[y], dests[d]);
+                }
+
+    // every pair of a few edge values, then whatever splitmix64 says
+    static const uint8_t edges[] = { 0, 1, 2, 3, 127, 128, 255 };
+    uint64_t rng = 0x5EED;
+    for (int l = 0; l < LANES; ++l)
+    {
+        if (l < 49)
+        {
+            Start.ax[l] = edges[l / 7];
+            Start.bx[l] = edges[l % 7];
+        }
+        else
+        {
+            uint64_t z = (rng += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            Start.ax[l] = (uint8_t)z;
+            Start.bx[l] = (uint8_t)(z >> 8);
+        }
+        Start.m0[l] = (uint8_t)(0xA5 ^ l);
+        Start.m1[l] = (uint8_t)(0x5A + l);
+        Start.halt[l] = 0;
+        for (int d = 0; d < 10; ++d)
+            Digits[d][l] = (uint8_t)d;
+    }
+    Start.wrote = false;
+}
+
+static bool IsOperand(char c)
+{
+    return c == 'A' || c == 'B' || (c >= '0' && c <= '9');
+}
+
+// Readable ( char c ) / LiveBit ( char c )
+// ⤷ Any register or digit / the LIVE_ bit of 'c', 0 past BX: vnpu-opt never
+//   moves an op that touches those, so they're never its to keep alive
+static bool Readable(char c)
+{
+    return RegisterIndex(c) >= 0 || (c >= '0' && c <= '9');
+}
+
+static int LiveBit(char c)
+{
+    return c == 'A' ? LIVE_A : c == 'B' ? LIVE_B : 0;
+}
+
+static bool Compares(const struct VnpuOp *op)
+{
+    switch (op->instr)
+    {
+        case '?': return CmpInstruction(op->com1, op->com2);
+        case '>': return GrThInstruction(op->com1, op->com2);
+        case '<': return LsThInstruction(op->com1, op->com2);
+        case '!': return NotEqInstruction(op->com1, op->com2);
+        default: return false;
+    }
+}
+
+bool Pure(const struct VnpuOp *op)
+{
+    if (op->kind != VNPU_OP_EXEC) return false;
+    switch (op->instr)
+    {
+        case '+': case '-': case '*': case '/':
+            return IsOperand(op->com1) && IsOperand(op->com2)
+                && (op->com3 == '\0' || op->com3 == 'A' || op->com3 == 'B');
+        case 'M':
+            return op->com3 == '\0' && ((op->com1 == 'A' && op->com2 == 'B') || (op->com1 == 'B' && op->com2 == 'A')
+                || (op->com1 >= '0' && op->com1 <= '9' && (op->com2 == 'A' || op->com2 == 'B')));
+        case '?': case '>': case '<': case '!':
+            return op->com3 == '\0' && !Compares(op); // a true one is an illegal instruction
+        default:
+            return false;
+    }
+}
+
+static const uint8_t *Source(const struct Lanes *s, char c)
+{
+    if (c == 'A') return s->ax;
+    if (c == 'B') return s->bx;
+    return Digits[c - '0'];
+}
+
+void Apply(const struct Lanes *in, struct Lanes *out, const struct VnpuOp *op)
+{
+    if (out != in) *out = *in;
+
+    if (op->instr == 'M')
+    {
+        if (op->com1 == 'A')
+            memcpy(out->bx, in->ax, LANES);
+        else if (op->com1 == 'B')
+            memcpy(out->ax, in->bx, LANES);
+        else
+            memset(op->com2 == 'A' ? out->ax : out->bx, op->com1 - '0', LANES);
+        return;
+    }
+    if (op->instr != '+' && op->instr != '-' && op->instr != '*' && op->instr != '/')
+        return; // a comparison that came out false
+
+    // the operands may be out->ax itself, so read everything first
+    uint8_t x[LANES], y[LANES];
+    memcpy(x, Source(in, op->com1), LANES);
+    memcpy(y, Source(in, op->com2), LANES);
+    uint8_t *dst = op->com3 == 'B' ? out->bx : out->ax;
+    out->wrote = true;
+
+    switch (op->instr)
+    {
+        case '+':
+            for (int l = 0; l < LANES; ++l)
+            {
+                unsigned r = (unsigned)x[l] + y[l];
+                dst[l] = out->m1[l] = (uint8_t)r;
+                out->m0[l] = (uint8_t)(r >> 8);
+            }
+            break;
+        case '-':
+            // a borrow sign-extends into MEM[0], see SubInstruction()
+            for (int l = 0; l < LANES; ++l)
+            {
+                dst[l] = out->m1[l] = (uint8_t)(x[l] - y[l]);
+                out->m0[l] = x[l] < y[l] ? 0xff : 0;
+            }
+            break;
+        case '*':
+            for (int l = 0; l < LANES; ++l)
+            {
+                unsigned r = (unsigned)x[l] * y[l];
+                dst[l] = out->m1[l] = (uint8_t)r;
+                out->m0[l] = (uint8_t)(r >> 8);
+            }
+            break;
+        case '/':
+            for (int l = 0; l < LANES; ++l)
+            {
+                dst[l] = out->m1[l] = y[l] ? (uint8_t)(x[l] / y[l]) : 0;
+                out->m0[l] = 0;
+                out->halt[l] |= y[l] ? 0 : 0xff;
+            }
+            break;
+    }
+}
+
+int LiveBefore(const struct VnpuOp *op, int live)
+{
+    int reads = 0;
+    char c1 = op->com1, c2 = op->com2;
+
+    if (op->kind == VNPU_OP_USAGE) return live;
+    if (op->kind != VNPU_OP_EXEC) return 0; // nothing after a halt is seen
+    switch (op->instr)
+    {
+        case '+': case '-': case '*': case '/':
+            if (!Readable(c1) || !Readable(c2) || (op->com3 && RegisterIndex(op->com3) < 0)) return 0;
+            reads = LiveBit(c1) | LiveBit(c2);
+            return (live & ~(LiveBit(op->com3 ? op->com3 : 'A') | LIVE_M)) | reads;
+        case 'M':
+            if (!Readable(c1) || RegisterIndex(c2) < 0 || c1 == c2) return 0;
+            return (live & ~LiveBit(c2)) | LiveBit(c1);
+        case '?': case '>': case '<': case '!':
+            return Compares(op) ? 0 : live;
+        case '@':
+            return live | LiveBit(c1);
+        case 'I':
+            if (c1 < '0' || c1 >= '0' + VNPU_PORT_COUNT || RegisterIndex(c2) < 0) return 0;
+            return live & ~LiveBit(c2);
+        case 'O':
+            if (c1 < '0' || c1 >= '0' + VNPU_PORT_COUNT || !Readable(c2)) return 0;
+            return live | LiveBit(c2);
+        case 'H':
+            return live;
+        // shared memory: illegal here, but what the program means on vnpu-smp
+        case 'L':
+            if (c1 < '0' || c1 >= '0' + VNPU_SHARED_WORDS || RegisterIndex(c2) < 0) return 0;
+            return live & ~LiveBit(c2);
+        case 'S':
+            if (c1 < '0' || c1 >= '0' + VNPU_SHARED_WORDS || !Readable(c2)) return 0;
+            return live | LiveBit(c2);
+        case 'X':
+            if (c1 < '0' || c1 >= '0' + VNPU_SHARED_WORDS || !Readable(c2)) return 0;
+            return (live & ~LIVE_A) | LiveBit(c2);
+        case 'C':
+            // compares AX before it overwrites it
+            if (c1 < '0' || c1 >= '0' + VNPU_SHARED_WORDS || !Readable(c2)) return 0;
+            return live | LIVE_A | LiveBit(c2);
+        case 'F': case 'W':
+            return live;
+        case '#':
+            if (RegisterIndex(c1) < 0) return 0;
+            return live & ~LiveBit(c1);
+        default:
+            return 0;
+    }
+}
+
+// EXACT CHECK
+//
+static void RunExact(const struct VnpuOp *ops, size_t len, unsigned ax, unsigned bx, struct Exact *e)
+{
+    static const uint8_t mem_start[2][2] = { { 0x00, 0x00 }, { 0xff, 0xff } };
+
+    for (int k = 0; k < 2; ++k)
+    {
+        struct VNPU vm;
+        VnpuReset(&vm, NULL);
+        vm.AX[0] = ax;
+        vm.BX[0] = bx;
+        vm.MEM[0][0] = mem_start[k][0];
+        vm.MEM[1][0] = mem_start[k][1];
+        for (size_t i = 0; i < len && VnpuStep(&vm, &ops[i]); ++i)
+            ;
+        e->ax = (uint8_t)vm.AX[0];
+        e->bx = (uint8_t)vm.BX[0];
+        e->mem[k][0] = (uint8_t)vm.MEM[0][0];
+        e->mem[k][1] = (uint8_t)vm.MEM[1][0];
+        e->reason = (uint8_t)vm.HaltReason;
+    }
+}
+
+static bool SameExact(const struct Exact *a, const struct Exact *b, int live)
+{
+    if (a->reason != b->reason) return false;
+    if (a->reason != VNPU_RUNNING) return true; // nothing after a halt is seen
+    if ((live & LIVE_A) && a->ax != b->ax) return false;
+    if ((live & LIVE_B) && a->bx != b->bx) return false;
+    if ((live & LIVE_M) && memcmp(a->mem, b->mem, sizeof a->mem) != 0) return false;
+    return true;
+}
+
+// Confirm ( struct Target *t, const struct VnpuOp *seq, int len )
+// ⤷ 'seq' against 't' from every ( AX, BX ), through the real machine
+static bool Confirm(struct Target *t, const struct VnpuOp *seq, int len)
+{
+    pthread_mutex_lock(&t->lock);
+    if (!t->exact)
+    {
+        struct Exact *exact = malloc(65536 * sizeof *exact);
+        if (exact)
+            for (unsigned in = 0; in < 65536; ++in)
+                RunExact(t->ops, t->len, in & 0xff, in >> 8, &exact[in]);
+        t->exact = exact;
+    }
+    pthread_mutex_unlock(&t->lock);
+    if (!t->exact) return false;
+
+    // candidates that pass the samples tend to fail on the same few inputs
+    int known = atomic_load_explicit(&t->cex_len, memory_order_acquire);
+    for (int i = 0; i < known; ++i)
+    {
+        struct Exact e;
+        unsigned in = t->cex[i];
+        RunExact(seq, (size_t)len, in & 0xff, in >> 8, &e);
+        if (!SameExact(&e, &t->exact[in], t->live)) return false;
+    }
+
+    for (unsigned in = 0; in < 65536; ++in)
+    {
+        struct Exact e;
+        RunExact(seq, (size_t)len, in & 0xff, in >> 8, &e);
+        if (SameExact(&e, &t->exact[in], t->live)) continue;
+
+        pthread_mutex_lock(&t->lock);
+        int n = atomic_load_explicit(&t->cex_len, memory_order_relaxed);
+        if (n < CEX_LEN)
+        {
+            t->cex[n] = (uint16_t)in;
+            atomic_store_explicit(&t->cex_len, n + 1, memory_order_release);
+        }
+        pthread_mutex_unlock(&t->lock);
+        return false;
+    }
+    return true;
+}
+
+// SEARCH
+//
+static bool Matches(const struct Lanes *s, const struct Target *t)
+{
+    const struct Lanes *g = &t->lanes;
+    uint8_t diff = 0;
+    for (int l = 0; l < LANES; ++l)
+    {
+        uint8_t keep = (uint8_t)~g->halt[l];
+        diff |= s->halt[l] ^ g->halt[l];
+        diff |= keep & ((t->la & (s->ax[l] ^ g->ax[l])) | (t->lb & (s->bx[l] ^ g->bx[l]))
+                      | (t->lm & ((s->m0[l] ^ g->m0[l]) | (s->m1[l] ^ g->m1[l]))));
+    }
+    return diff == 0 && (!(t->live & LIVE_M) || s->wrote == g->wrote);
+}
+
+// Reachable ( const struct Lanes *s, const struct Target *t, int left, bool *a_only, bool *b_only )
+// ⤷ False if 's' can't become 't' in 'left' more ops; otherwise says whether
+//   the last op has to write AX ( or BX )
+static bool Reachable(const struct Lanes *s, const struct Target *t, int left, bool *fix_a, bool *fix_b)
+{
+    const struct Lanes *g = &t->lanes;
+    uint8_t early = 0, pending = 0, da = 0, db = 0, dm = 0;
+    for (int l = 0; l < LANES; ++l)
+    {
+        uint8_t keep = (uint8_t)~g->halt[l];
+        early |= s->halt[l] & keep;                // halts never come undone
+        pending |= g->halt[l] & (uint8_t)~s->halt[l];
+        da |= keep & t->la & (s->ax[l] ^ g->ax[l]);
+        db |= keep & t->lb & (s->bx[l] ^ g->bx[l]);
+        dm |= keep & t->lm & ((s->m0[l] ^ g->m0[l]) | (s->m1[l] ^ g->m1[l]));
+    }
+    if (early) return false;
+    if ((t->live & LIVE_M) && s->wrote && !g->wrote) return false; // nor do writes
+
+    int need = (da != 0) + (db != 0);
+    if (need == 0 && (pending || dm || ((t->live & LIVE_M) && g->wrote && !s->wrote)))
+        need = 1;
+    *fix_a = da != 0;
+    *fix_b = db != 0;
+    return need <= left;
+}
+
+static bool WritesB(const struct VnpuOp *op)
+{
+    return (op->instr == 'M' && op->com2 == 'B' && op->com1 != 'B') || op->com3 == 'B';
+}
+
+// Descend ( struct Target *t, struct Lanes *stack, struct VnpuOp *seq, int depth, int len )
+// ⤷ Depth-first over what follows seq[0 .. depth-1], the first match in Alphabet order
+static bool Descend(struct Target *t, struct Lanes *stack, struct VnpuOp *seq, int depth, int len)
+{
+    if (depth == len)
+        return Matches(&stack[depth], t) && Confirm(t, seq, len);
+
+    bool fix_a, fix_b;
+    if (!Reachable(&stack[depth], t, len - depth, &fix_a, &fix_b)) return false;
+
+    for (size_t i = 0; i < AlphabetLen; ++i)
+    {
+        const struct VnpuOp *op = &Alphabet[i];
+        // one op left: it has to be the one writing the wrong register
+        if (depth == len - 1 && ((fix_b && !WritesB(op)) || (fix_a && WritesB(op))))
+            continue;
+        Apply(&stack[depth], &stack[depth + 1], op);
+        seq[depth] = *op;
+        if (Descend(t, stack, seq, depth + 1, len)) return true;
+    }
+    return false;
+}
+
+static void *SearchMain(void *arg)
+{
+    struct Search *s = arg;
+    struct Lanes stack[MAX_SEQ + 1];
+    struct VnpuOp seq[MAX_SEQ];
+
+    for (;;)
+    {
+        size_t first = atomic_fetch_add(&s->next, 1);
+        if (first >= AlphabetLen || first > atomic_load(&s->best)) break;
+
+        stack[0] = Start;
+        Apply(&stack[0], &stack[1], &Alphabet[first]);
+        seq[0] = Alphabet[first];
+        if (!Descend(s->t, stack, seq, 1, s->len)) continue;
+
+        memcpy(s->found[first], seq, sizeof seq);
+        size_t best = atomic_load(&s->best);
+        while (first < best && !atomic_compare_exchange_weak(&s->best, &best, first))
+            ;
+    }
+    return NULL;
+}
+
+// SearchLen ( struct Target *t, int len, struct VnpuOp out[MAX_SEQ] )
+// ⤷ True if some 'len' ops do what 't' does, the first of them in 'out'
+static bool SearchLen(struct Target *t, int len, struct VnpuOp out[MAX_SEQ])
+{
+    if (len == 0)
+    {
+        struct Lanes stack[1] = { Start };
+        return Matches(&stack[0], t) && Confirm(t, out, 0);
+    }
+
+    struct Search s;
+    s.t = t;
+    s.len = len;
+    atomic_init(&s.next, 0);
+    atomic_init(&s.best, AlphabetLen);
+    s.found = malloc(AlphabetLen * sizeof *s.found);
+    if (!s.found) return false;
+
+    // short ones are over before a thread would have started
+    long threads = len < 3 ? 1 : Threads;
+    pthread_t *tids = calloc((size_t)threads, sizeof *tids);
+    long started = 0;
+    if (tids)
+        for (; started < threads - 1; ++started)
+            if (pthread_create(&tids[started], NULL, SearchMain, &s) != 0)
+                break;
+    SearchMain(&s);
+    for (long i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+    free(tids);
+
+    size_t best = atomic_load(&s.best);
+    if (best < AlphabetLen)
+        memcpy(out, s.found[best], sizeof s.found[best]);
+    free(s.found);
+    return best < AlphabetLen;
+}
+
+int Shortest(struct Target *t, int max, struct VnpuOp out[MAX_SEQ])
+{
+    struct Lanes lanes = Start;
+    for (size_t i = 0; i < t->len; ++i)
+        Apply(&lanes, &lanes, &t->ops[i]);
+    t->lanes = lanes;
+    t->la = t->live & LIVE_A ? 0xff : 0;
+    t->lb = t->live & LIVE_B ? 0xff : 0;
+    t->lm = t->live & LIVE_M ? 0xff : 0;
+
+    for (int len = 0; len <= max; ++len)
+        if (SearchLen(t, len, out)) return len;
+    return -1;
+}
+
+// DRIVER
+//
+static void FormatSeq(char *buf, size_t cap, const struct VnpuOp *ops, size_t len)
+{
+    size_t at = 0;
+    buf[0] = '\0';
+    for (size_t i = 0; i < len && at + 8 < cap; ++i)
+    {
+        char text[8];
+        VnpuFormatOp(&ops[i], text);
+        at += (size_t)snprintf(buf + at, cap - at, "%s%s", i ? "; " : "", text);
+    }
+    if (len == 0) snprintf(buf, cap, "nothing");
+}
+
+// SearchKey ( char key[KEY_LEN], const struct VnpuOp *ops, size_t len, int live, int max )
+// ⤷ What a search is remembered by: the stretch, what's live and how long a result may be
+static void SearchKey(char key[KEY_LEN], const struct VnpuOp *ops, size_t len, int live, int max)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        key[n++] = ops[i].instr;
+        key[n++] = ops[i].com1;
+        key[n++] = ops[i].com2;
+        key[n++] = ops[i].com3 ? ops[i].com3 : '_';
+    }
+    snprintf(key + n, KEY_LEN - n, "%d%d", live, max);
+}
+
+// Tried ( const char *key ) / Remember ( const char *key )
+// ⤷ True if this exact search already came up empty / that it did
+static bool Tried(const char *key)
+{
+    for (size_t i = 0; i < FailedLen; ++i)
+        if (strcmp(Failed[i], key) == 0) return true;
+    return false;
+}
+
+static void Remember(const char *key)
+{
+    if (FailedLen == FailedCap)
+    {
+        size_t cap = FailedCap ? FailedCap * 2 : 64;
+        char **failed = realloc(Failed, cap * sizeof *failed);
+        if (!failed) return;
+        Failed = failed;
+        FailedCap = cap;
+    }
+    char *copy = strdup(key);
+    if (copy) Failed[FailedLen++] = copy;
+}
+
+void Optimize(struct VnpuOp *ops, size_t *len, int *lines, int live_out, const char *name)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t span = *len < (size_t)Window ? *len : (size_t)Window; span > 0 && !changed; --span)
+        {
+            for (size_t at = 0; at + span <= *len && !changed; ++at)
+            {
+                int live = LIVE_ALL;
+                if (Liveness)
+                {
+                    live = live_out;
+                    for (size_t i = *len; i > at + span; --i)
+                        live = LiveBefore(&ops[i - 1], live);
+                }
+                int max = (int)span - 1 < MaxLen ? (int)span - 1 : MaxLen;
+                char key[KEY_LEN];
+                SearchKey(key, &ops[at], span, live, max);
+                if (Tried(key)) continue;
+
+                struct Target t = { .ops = &ops[at], .len = span, .live = live };
+                pthread_mutex_init(&t.lock, NULL);
+                atomic_init(&t.cex_len, 0);
+                struct VnpuOp best[MAX_SEQ];
+                int found = Shortest(&t, max, best);
+                free(t.exact);
+                pthread_mutex_destroy(&t.lock);
+                if (found < 0)
+                {
+                    Remember(key);
+                    continue;
+                }
+
+                if (!Quiet)
+                {
+                    char before[256], after[256];
+                    FormatSeq(before, sizeof before, &ops[at], span);
+                    FormatSeq(after, sizeof after, best, (size_t)found);
+                    fprintf(stderr, "%s:%d: %s => %s\n", name, lines[at], before, after);
+                }
+
+                int line = lines[at];
+                memmove(&ops[at + (size_t)found], &ops[at + span], (*len - at - span) * sizeof *ops);
+                memmove(&lines[at + (size_t)found], &lines[at + span], (*len - at - span) * sizeof *lines);
+                for (int i = 0; i < found; ++i)
+                {
+                    ops[at + (size_t)i] = best[i];
+                    lines[at + (size_t)i] = line;
+                }
+                *len -= span - (size_t)found;
+                changed = true;
+            }
+        }
+    }
+}
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// LineLen ( size_t k ) / LineBlank ( size_t k )
+// ⤷ Length of line 'k' without its newline / true if it is nothing but one
+static size_t LineLen(size_t k)
+{
+    return LineAt[k + 1] - LineAt[k] - (Text[LineAt[k + 1] - 1] == '\n');
+}
+
+static bool LineBlank(size_t k)
+{
+    return LineAt[k + 1] - LineAt[k] == 1 && Text[LineAt[k]] == '\n';
+}
+
+static char *ReadAll(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    char *text = NULL;
+    size_t cap = 0;
+    *len = 0;
+    for (;;)
+    {
+        if (*len == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            char *grown = realloc(text, cap);
+            if (!grown)
+            {
+                free(text);
+                fclose(f);
+                return NULL;
+            }
+            text = grown;
+        }
+        size_t got = fread(text + *len, 1, cap - *len, f);
+        if (got == 0) break;
+        *len += got;
+    }
+    fclose(f);
+    return text;
+}
+
+void printOptUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-opt [-j THREADS] [-n MAXLEN] [-w WINDOW] [-L] [-q] [-o OUT] PROGRAM\n"
+        "  -j THREADS  worker threads ( default: one per core )\n"
+        "  -n MAXLEN   longest replacement to look for, at most %d ( default: 3 )\n"
+        "  -w WINDOW   longest stretch of ops to replace at once ( default: 8 )\n"
+        "  -L          only keep what the rest of the program can still see\n"
+        "  -q          don't report every replacement\n"
+        "  -o OUT      write the optimized program to OUT instead of stdout\n",
+        MAX_SEQ
+    );
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL;
+    int opt;
+
+    Threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "j:n:w:Lqo:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j': Threads = strtol(optarg, NULL, 10); break;
+            case 'n': MaxLen = atoi(optarg); break;
+            case 'w': Window = atoi(optarg); break;
+            case 'L': Liveness = true; break;
+            case 'q': Quiet = true; break;
+            case 'o': out_path = optarg; break;
+            default:
+                printOptUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || Threads < 1 || MaxLen < 0 || MaxLen > MAX_SEQ || Window < 1 || Window > 16)
+    {
+        printOptUsage();
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    struct VnpuProgram prog;
+    Text = ReadAll(path, &TextLen);
+    if (!Text || !VnpuLoad(&prog, Text, TextLen))
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", path);
+        return 1;
+    }
+    Build();
+
+    LineCount = 1;
+    for (size_t i = 0; i + 1 < TextLen; ++i)
+        if (Text[i] == '\n') LineCount++;
+    LineAt = malloc((LineCount + 1) * sizeof *LineAt);
+    int *line_ops = calloc(LineCount, sizeof *line_ops);
+    bool *movable = calloc(prog.len + 1, sizeof *movable);
+    int *live_after = malloc((prog.len + 1) * sizeof *live_after);
+    struct VnpuOp *window = malloc((prog.len + 1) * sizeof *window);
+    int *window_lines = malloc((prog.len + 1) * sizeof *window_lines);
+    if (!LineAt || !line_ops || !movable || !live_after || !window || !window_lines)
+    {
+        fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+        return 1;
+    }
+    LineAt[0] = 0;
+    for (size_t i = 0, k = 1; i + 1 < TextLen; ++i)
+        if (Text[i] == '\n') LineAt[k++] = i + 1;
+    LineAt[LineCount] = TextLen;
+
+    // only ops alone on an "X Y Z" ( or "X Y Z D" ) line get moved around
+    for (size_t i = 0; i < prog.len; ++i)
+        line_ops[prog.ops[i].line - 1]++;
+    for (size_t i = 0; i < prog.len; ++i)
+    {
+        size_t k = (size_t)prog.ops[i].line - 1;
+        movable[i] = Pure(&prog.ops[i]) && line_ops[k] == 1 && LineLen(k) == (prog.ops[i].com3 ? 7u : 5u);
+    }
+
+    int live = 0;
+    for (size_t i = prog.len; i > 0; --i)
+    {
+        live_after[i - 1] = live;
+        live = LiveBefore(&prog.ops[i - 1], live);
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot write \"%s\".\n", out_path);
+        return 1;
+    }
+
+    double start = NowSec();
+    unsigned long long cycles_before = 0, cycles_after = 0;
+    size_t ops_after = 0;
+    size_t line = 0;
+    for (size_t i = 0; i < prog.len; )
+    {
+        // a window: movable ops, nothing but blank lines in between
+        size_t end = i;
+        while (end < prog.len && movable[end])
+        {
+            if (end > i)
+            {
+                bool blank = true;
+                for (size_t k = (size_t)prog.ops[end - 1].line; k + 1 < (size_t)prog.ops[end].line; ++k)
+                    blank = blank && LineBlank(k);
+                if (!blank) break;
+            }
+            end++;
+        }
+        // a short line after it reads the tail of the window's last line
+        // ( see VnpuLoad() ), so that one has to stay as it is; '.' and 'H'
+        // don't look past their newline
+        if (end > i)
+        {
+            size_t k = (size_t)prog.ops[end - 1].line;
+            while (k < LineCount && LineBlank(k)) k++;
+            if (k < LineCount && LineAt[k + 1] - LineAt[k] <= 3
+                && !(LineLen(k) == 1 && (Text[LineAt[k]] == '.' || Text[LineAt[k]] == 'H')))
+                end--;
+        }
+        if (end == i)
+        {
+            cycles_before += VnpuOpCycles(&prog.ops[i]);
+            cycles_after += VnpuOpCycles(&prog.ops[i]);
+            ops_after++;
+            i++;
+            continue;
+        }
+
+        size_t len = end - i;
+        for (size_t k = 0; k < len; ++k)
+        {
+            window[k] = prog.ops[i + k];
+            window_lines[k] = prog.ops[i + k].line;
+            cycles_before += VnpuOpCycles(&window[k]);
+        }
+        Optimize(window, &len, window_lines, live_after[end - 1], path);
+        for (size_t k = 0; k < len; ++k)
+            cycles_after += VnpuOpCycles(&window[k]);
+        ops_after += len;
+
+        // everything up to the window as it was, then the window
+        size_t first = (size_t)prog.ops[i].line - 1, last = (size_t)prog.ops[end - 1].line - 1;
+        fwrite(Text + LineAt[line], 1, LineAt[first] - LineAt[line], out);
+        for (size_t k = 0; k < len; ++k)
+        {
+            char op_text[8];
+            VnpuFormatOp(&window[k], op_text);
+            fprintf(out, "%s\n", op_text);
+        }
+        line = last + 1;
+        i = end;
+    }
+    fwrite(Text + LineAt[line], 1, TextLen - LineAt[line], out);
+    double elapsed = NowSec() - start;
+
+    if (out != stdout) fclose(out);
+    else fflush(out);
+    fprintf(stderr, "VNPU => %zu ops => %zu, %llu cycles => %llu per run, in %.3f s.\n",
+            prog.len, ops_after, cycles_before, cycles_after, elapsed);
+
+    for (size_t i = 0; i < FailedLen; ++i)
+        free(Failed[i]);
+    free(Failed);
+    free(movable);
+    free(window_lines);
+    free(window);
+    free(live_after);
+    free(line_ops);
+    free(LineAt);
+    VnpuFree(&prog);
+    free(Text);
+    return 0;
+}
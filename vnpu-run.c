@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "vnpu.h"
+#include "ports.h"
+
+/*
+	vnpu-run
+	- Runs a whole batch of v'NIS programs, one fresh VNPU per program,
+	  spread over every core with a work-stealing scheduler.
+	- Programs come from a manifest ( one path per line, '#' comments,
+	  relative paths are relative to the manifest ) or from a directory
+	  ( every regular file in it, sorted by name ).
+	- Every job prints into its own buffer; the buffers are written out
+	  in input order once the batch is done, so the output does not
+	  depend on how the jobs were scheduled.
+	- The 337 ms clock is not honoured here unless -s is given: cycles
+	  are still counted, just not slept through.
+	- -I / -C / -T / -O put every job on an instruction, cycle, wall time
+	  and output budget. A job that runs out halts with its own reason,
+	  and the exit code is the one of the first job ( in input order )
+	  that didn't halt cleanly, see VnpuExitCode().
+	- With -p / -t every job is profiled: executed instructions and cycles
+	  are attributed to the source line they came from, then written out
+	  as folded stacks ( "program;line: X Y Z count", what flamegraph.pl
+	  and friends eat ) and / or as a top-N table of the hottest lines.
+	- With -P the batch is a single program, given by path instead of the
+	  manifest, that gets its 'I' / 'O' ports from the shared-memory object
+	  a host created ( see ports.h, vnpu-host.c ). Its output ports are
+	  closed once it halts. Time spent waiting on a ring counts against
+	  -T like any other, so a host that never answers can't hang it.
+*/
+
+#define CACHE_LINE 64
+
+// What one source line of one job cost
+struct LineStat
+{
+    int line;
+    char text[8];
+    unsigned long long insns;
+    unsigned long long cycles;
+    const char *path;
+    size_t job; // index in Jobs[], for stable tie-breaking
+};
+
+struct Job
+{
+    char *path;
+    char *output;
+    size_t output_len;
+    enum VnpuHalt halt;
+    bool load_failed;
+
+    struct LineStat *lines; // only with profiling on, sorted by line
+    size_t line_count;
+};
+
+// Chase-Lev work-stealing deque. All the jobs are known up front, so the
+// buffer never has to grow: the owner pushes everything before the workers
+// start, then only pops from the bottom while thieves take from the top.
+struct Deque
+{
+    _Alignas(CACHE_LINE) atomic_long top;
+    _Alignas(CACHE_LINE) atomic_long bottom;
+    _Alignas(CACHE_LINE) size_t *buf;
+    long cap;
+};
+
+struct Worker
+{
+    struct Deque dq;
+    pthread_t thread;
+    unsigned seed;
+    int id;
+};
+
+struct Job *Jobs;
+size_t JobCount;
+struct Worker *Workers;
+int WorkerCount;
+bool Verbose = false;
+bool Profiling = false;
+bool WeighCycles = false; // folded stacks weighted by cycles instead of instructions
+struct VnpuLimits Limits;
+bool Throttle = false;
+struct VnpuPortOps *Ports; // -P, NULL otherwise
+
+// DequePush ( struct Deque *dq, size_t job )
+// ⤷ Owner-only, and only before the workers are started
+void DequePush(struct Deque *dq, size_t job);
+
+// DequePop ( struct Deque *dq, size_t *job )
+// ⤷ Owner-only. Returns false if the deque is empty.
+bool DequePop(struct Deque *dq, size_t *job);
+
+// DequeSteal ( struct Deque *dq, size_t *job )
+// ⤷ Any thread. Returns false if there was nothing to take ( or it lost a race ).
+bool DequeSteal(struct Deque *dq, size_t *job);
+
+// RunJob ( struct Job *job )
+// ⤷ Loads and runs one program on its own VNPU, buffering what it prints
+void RunJob(struct Job *job);
+
+// CollectDir / CollectManifest ( const char *path )
+// ⤷ Fill Jobs[] from a directory or a manifest file. Return false on error.
+bool CollectDir(const char *path);
+bool CollectManifest(const char *path);
+
+// CollectLineStats ( struct Job *job, const struct VnpuProgram *prog, const struct VnpuProfile *prof )
+// ⤷ Folds the per-op counters of a finished job into per-line ones
+bool CollectLineStats(struct Job *job, const struct VnpuProgram *prog, const struct VnpuProfile *prof);
+
+// WriteFolded ( FILE *f ) / PrintTopLines ( size_t n )
+// ⤷ The two profile reports, over every job
+void WriteFolded(FILE *f);
+void PrintTopLines(size_t n);
+
+void printRunUsage(void);
+
+void DequePush(struct Deque *dq, size_t job)
+{
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    dq->buf[b % dq->cap] = job;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+bool DequePop(struct Deque *dq, size_t *job)
+{
+    long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *job = dq->buf[b % dq->cap];
+    if (t == b)
+    {
+        // last one left: race the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool DequeSteal(struct Deque *dq, size_t *job)
+{
+    long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t >= b) return false;
+
+    *job = dq->buf[t % dq->cap];
+    return atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+        memory_order_seq_cst, memory_order_relaxed);
+}
+
+void RunJob(struct Job *job)
+{
+    struct VnpuProgram prog;
+    if (!VnpuLoadFile(&prog, job->path))
+    {
+        job->load_failed = true;
+        return;
+    }
+
+    FILE *out = open_memstream(&job->output, &job->output_len);
+    if (!out)
+    {
+        VnpuFree(&prog);
+        job->load_failed = true;
+        return;
+    }
+
+    struct VnpuProfile prof = {0};
+    if (Profiling && !VnpuProfileInit(&prof, &prog))
+    {
+        fclose(out);
+        VnpuFree(&prog);
+        job->load_failed = true;
+        return;
+    }
+
+    struct VNPU vm;
+    VnpuReset(&vm, out);
+    if (Profiling) vm.prof = &prof;
+    vm.throttle = Throttle;
+    vm.ports = Ports;
+    VnpuSetLimits(&vm, &Limits);
+    // -P ports give up after a short spin, so the budgets get looked at while waiting
+    unsigned spins = 0;
+    while ((job->halt = VnpuRun(&vm, &prog)) == VNPU_RUNNING)
+        PortBackoff(&spins);
+
+    fclose(out);
+    if (Profiling)
+    {
+        if (!CollectLineStats(job, &prog, &prof))
+            job->load_failed = true;
+        VnpuProfileFree(&prof);
+    }
+    VnpuFree(&prog);
+}
+
+bool CollectLineStats(struct Job *job, const struct VnpuProgram *prog, const struct VnpuProfile *prof)
+{
+    // ops are already in line order, so equal lines are next to each other
+    job->lines = calloc(prog->len ? prog->len : 1, sizeof *job->lines);
+    if (!job->lines) return false;
+
+    for (size_t pc = 0; pc < prog->len; ++pc)
+    {
+        const struct VnpuOp *op = &prog->ops[pc];
+        struct LineStat *ls = job->line_count ? &job->lines[job->line_count - 1] : NULL;
+        if (!ls || ls->line != op->line)
+        {
+            ls = &job->lines[job->line_count++];
+            ls->line = op->line;
+            ls->path = job->path;
+            ls->job = (size_t)(job - Jobs);
+            VnpuFormatOp(op, ls->text);
+        }
+        ls->insns  += prof->insns[pc];
+        ls->cycles += prof->cycles[pc];
+    }
+    return true;
+}
+
+void WriteFolded(FILE *f)
+{
+    for (size_t i = 0; i < JobCount; ++i)
+    {
+        const struct Job *job = &Jobs[i];
+
+        // ';' separates frames, so it can't show up inside one
+        char frame[4096];
+        snprintf(frame, sizeof frame, "%s", job->path);
+        for (char *c = frame; *c; ++c)
+            if (*c == ';') *c = '_';
+
+        for (size_t k = 0; k < job->line_count; ++k)
+        {
+            const struct LineStat *ls = &job->lines[k];
+            unsigned long long weight = WeighCycles ? ls->cycles : ls->insns;
+            if (weight == 0) continue;
+
+            char text[8];
+            snprintf(text, sizeof text, "%s", ls->text);
+            for (char *c = text; *c; ++c)
+                if (*c == ';') *c = '_';
+
+            fprintf(f, "%s;%d: %s %llu\n", frame, ls->line, text, weight);
+        }
+    }
+}
+
+static int CompareHotness(const void *a, const void *b)
+{
+    const struct LineStat *x = *(const struct LineStat *const *)a;
+    const struct LineStat *y = *(const struct LineStat *const *)b;
+    if (x->insns != y->insns) return x->insns < y->insns ? 1 : -1;
+    if (x->cycles != y->cycles) return x->cycles < y->cycles ? 1 : -1;
+    if (x->job != y->job) return x->job < y->job ? -1 : 1; // ties in input order
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+void PrintTopLines(size_t n)
+{
+    size_t total = 0;
+    unsigned long long all_insns = 0, all_cycles = 0;
+    for (size_t i = 0; i < JobCount; ++i)
+        total += Jobs[i].line_count;
+
+    const struct LineStat **order = malloc((total ? total : 1) * sizeof *order);
+    if (!order) return;
+
+    size_t k = 0;
+    for (size_t i = 0; i < JobCount; ++i)
+        for (size_t j = 0; j < Jobs[i].line_count; ++j)
+        {
+            order[k++] = &Jobs[i].lines[j];
+            all_insns  += Jobs[i].lines[j].insns;
+            all_cycles += Jobs[i].lines[j].cycles;
+        }
+    qsort(order, total, sizeof *order, CompareHotness);
+
+    fprintf(stderr, "VNPU => %llu instructions, %llu cycles. Hottest lines:\n", all_insns, all_cycles);
+    fprintf(stderr, "%14s %7s %14s  %s\n", "instructions", "%", "cycles", "line");
+    for (size_t i = 0; i < n && i < total && order[i]->insns > 0; ++i)
+    {
+        const struct LineStat *ls = order[i];
+        fprintf(stderr, "%14llu %6.2f%% %14llu  %s:%d: %s\n",
+                ls->insns, all_insns ? 100.0 * (double)ls->insns / (double)all_insns : 0.0,
+                ls->cycles, ls->path, ls->line, ls->text);
+    }
+    free(order);
+}
+
+void *WorkerMain(void *arg)
+{
+    struct Worker *self = arg;
+    size_t job;
+
+    for (;;)
+    {
+        if (DequePop(&self->dq, &job))
+        {
+            RunJob(&Jobs[job]);
+            continue;
+        }
+
+        // Nothing left at home: sweep the others starting from a random victim.
+        // Nobody creates jobs once we're running, so a sweep that finds every
+        // deque empty means we're done.
+        bool stole = false;
+        bool busy = false;
+        int start = rand_r(&self->seed) % WorkerCount;
+        for (int k = 0; k < WorkerCount && !stole; ++k)
+        {
+            struct Deque *victim = &Workers[(start + k) % WorkerCount].dq;
+            if (victim == &self->dq) continue;
+            if (DequeSteal(victim, &job))
+                stole = true;
+            else if (atomic_load_explicit(&victim->top, memory_order_relaxed) <
+                     atomic_load_explicit(&victim->bottom, memory_order_relaxed))
+                busy = true; // lost a race, there's still work there
+        }
+
+        if (stole)
+            RunJob(&Jobs[job]);
+        else if (!busy)
+            break;
+    }
+    return NULL;
+}
+
+static bool AddJob(const char *dir, const char *name)
+{
+    static size_t cap = 0;
+    if (JobCount == cap)
+    {
+        cap = cap ? cap * 2 : 256;
+        struct Job *grown = realloc(Jobs, cap * sizeof *grown);
+        if (!grown) return false;
+        Jobs = grown;
+    }
+
+    struct Job *job = &Jobs[JobCount];
+    memset(job, 0, sizeof *job);
+
+    size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+    job->path = malloc(len);
+    if (!job->path) return false;
+    if (dir)
+        snprintf(job->path, len, "%s/%s", dir, name);
+    else
+        snprintf(job->path, len, "%s", name);
+
+    JobCount++;
+    return true;
+}
+
+static int CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+bool CollectDir(const char *path)
+{
+    DIR *d = opendir(path);
+    if (!d) return false;
+
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *ent;
+    bool ok = true;
+
+    while (ok && (ent = readdir(d)) != NULL)
+    {
+        if (ent->d_name[0] == '.') continue;
+
+        char full[4096];
+        struct stat st;
+        snprintf(full, sizeof full, "%s/%s", path, ent->d_name);
+        if (stat(full, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            char **grown = realloc(names, cap * sizeof *grown);
+            if (!grown) { ok = false; break; }
+            names = grown;
+        }
+        names[count] = strdup(ent->d_name);
+        if (!names[count]) { ok = false; break; }
+        count++;
+    }
+    closedir(d);
+
+    qsort(names, count, sizeof *names, CompareNames);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (ok && !AddJob(path, names[i])) ok = false;
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+bool CollectManifest(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    // relative entries are relative to the manifest itself
+    char dir[4096];
+    snprintf(dir, sizeof dir, "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = '\0';
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    bool ok = true;
+
+    while (ok && (n = getline(&line, &cap, f)) != -1)
+    {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r' ||
+                         line[n - 1] == ' '  || line[n - 1] == '\t'))
+            line[--n] = '\0';
+        char *entry = line;
+        while (*entry == ' ' || *entry == '\t') entry++;
+        if (*entry == '\0' || *entry == '#') continue;
+
+        if (entry[0] == '/' || !slash)
+            ok = AddJob(NULL, entry);
+        else
+            ok = AddJob(dir, entry);
+    }
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+void printRunUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-run [-j THREADS] [-v] [-s] [-I INSNS] [-C CYCLES] [-T MS] [-O BYTES]\n"
+        "                [-p FOLDED] [-t N] [-c] [-P SHM] MANIFEST|DIRECTORY\n"
+        "  -j THREADS  worker threads ( default: one per online core )\n"
+        "  -v          print a '==> path <==' header before each job's output,\n"
+        "              why each job stopped and a summary line on stderr\n"
+        "  -s          honour the 337 ms instruction clock\n"
+        "  -I INSNS    halt a job after INSNS instructions     ( exit code 3 )\n"
+        "  -C CYCLES   halt a job after CYCLES 337 ms cycles   ( exit code 4 )\n"
+        "  -T MS       halt a job after MS ms of wall time     ( exit code 5 )\n"
+        "  -O BYTES    halt a job before it prints past BYTES  ( exit code 6 )\n"
+        "  -p FOLDED   profile every job, write folded stacks to FOLDED ( '-' for stdout )\n"
+        "  -t N        profile every job, print the N hottest lines on stderr\n"
+        "  -c          weigh folded stacks by cycles instead of instructions\n"
+        "  -P SHM      run the single program PROGRAM ( given instead of MANIFEST )\n"
+        "              with 'I' / 'O' attached to the ports in shared-memory object SHM\n"
+    );
+}
+
+int main(int argc, char **argv)
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *folded_path = NULL;
+    const char *shm_name = NULL;
+    long top = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:vsI:C:T:O:p:t:cP:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'v':
+                Verbose = true;
+                break;
+            case 's':
+                Throttle = true;
+                break;
+            case 'I':
+                Limits.max_insns = strtoull(optarg, NULL, 10);
+                break;
+            case 'C':
+                Limits.max_cycles = strtoull(optarg, NULL, 10);
+                break;
+            case 'T':
+                Limits.max_wall_ms = strtoull(optarg, NULL, 10);
+                break;
+            case 'O':
+                Limits.max_output = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                folded_path = optarg;
+                Profiling = true;
+                break;
+            case 't':
+                top = strtol(optarg, NULL, 10);
+                Profiling = true;
+                break;
+            case 'c':
+                WeighCycles = true;
+                break;
+            case 'P':
+                shm_name = optarg;
+                break;
+            default:
+                printRunUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || threads < 1)
+    {
+        printRunUsage();
+        return 1;
+    }
+
+    const char *source = argv[optind];
+    struct stat st;
+    if (stat(source, &st) != 0)
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot open \"%s\".\n", source);
+        return 1;
+    }
+    if (shm_name ? !AddJob(NULL, source) :
+        !(S_ISDIR(st.st_mode) ? CollectDir(source) : CollectManifest(source)))
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot collect programs from \"%s\".\n", source);
+        return 1;
+    }
+
+    // a ring has exactly one consumer and one producer, so one program at a time
+    struct VnpuShm *shm = NULL;
+    struct VnpuShmPorts shm_ports;
+    struct VnpuPortOps port_ops;
+    if (shm_name)
+    {
+        shm = VnpuShmAttach(shm_name);
+        if (!shm)
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot attach to \"%s\".\n", shm_name);
+            return 1;
+        }
+        VnpuShmBind(&shm_ports, shm, &port_ops);
+        Ports = &port_ops;
+    }
+
+    if ((size_t)threads > JobCount && JobCount > 0)
+        threads = (long)JobCount;
+    WorkerCount = (int)threads;
+    // struct Deque keeps top and bottom on cache lines of their own
+    Workers = aligned_alloc(CACHE_LINE, (size_t)WorkerCount * sizeof *Workers);
+    if (!Workers)
+    {
+        fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+        return 1;
+    }
+    memset(Workers, 0, (size_t)WorkerCount * sizeof *Workers);
+
+    for (int i = 0; i < WorkerCount; ++i)
+    {
+        struct Worker *wk = &Workers[i];
+        wk->id = i;
+        wk->seed = 0x9e3779b9u * (unsigned)(i + 1);
+        wk->dq.cap = (long)(JobCount / (size_t)WorkerCount + 1);
+        wk->dq.buf = malloc((size_t)wk->dq.cap * sizeof *wk->dq.buf);
+        if (!wk->dq.buf) return 1;
+        atomic_init(&wk->dq.top, 0);
+        atomic_init(&wk->dq.bottom, 0);
+    }
+
+    // Deal the jobs out in contiguous runs; pushing them backwards makes
+    // every owner pop its own run front to back.
+    for (size_t i = JobCount; i-- > 0; )
+        DequePush(&Workers[i * (size_t)WorkerCount / (JobCount ? JobCount : 1)].dq, i);
+
+    for (int i = 1; i < WorkerCount; ++i)
+        pthread_create(&Workers[i].thread, NULL, WorkerMain, &Workers[i]);
+    WorkerMain(&Workers[0]);
+    for (int i = 1; i < WorkerCount; ++i)
+        pthread_join(Workers[i].thread, NULL);
+
+    if (shm)
+    {
+        VnpuShmRelease(&shm_ports);
+        VnpuShmDetach(shm);
+    }
+
+    int status = 0;
+    size_t unclean = 0, failed = 0;
+
+    if (folded_path)
+    {
+        FILE *f = strcmp(folded_path, "-") == 0 ? stdout : fopen(folded_path, "w");
+        if (f)
+        {
+            WriteFolded(f);
+            if (f != stdout) fclose(f);
+        }
+        else
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot write \"%s\".\n", folded_path);
+            status = 1;
+        }
+    }
+    if (top > 0)
+        PrintTopLines((size_t)top);
+
+    for (size_t i = 0; i < JobCount; ++i)
+    {
+        struct Job *job = &Jobs[i];
+        if (Verbose)
+            printf("==> %s <==\n", job->path);
+
+        if (job->load_failed)
+        {
+            fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", job->path);
+            failed++;
+            if (status == 0) status = 1;
+        }
+        else
+        {
+            fwrite(job->output, 1, job->output_len, stdout);
+            int code = VnpuExitCode(job->halt);
+            if (code != 0)
+            {
+                unclean++;
+                if (status == 0) status = code;
+            }
+            if (Verbose)
+                fprintf(stderr, "VNPU => %s: %s.\n", job->path, VnpuHaltName(job->halt));
+        }
+        free(job->output);
+        free(job->lines);
+        free(job->path);
+    }
+
+    if (Verbose)
+        fprintf(stderr, "VNPU => %zu programs, %zu halted uncleanly, %zu failed to load, %d threads.\n",
+                JobCount, unclean, failed, WorkerCount);
+
+    for (int i = 0; i < WorkerCount; ++i)
+        free(Workers[i].dq.buf);
+    free(Workers);
+    free(Jobs);
+    return status;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "vnpu.h"
+#include "ports.h"
+
+#if VNPU_LIMBS > 1
+#error "vnpu-smp shares 64-bit words, build it with VNPU_WORD_SIZE up to 64"
+#endif
+
+/*
+	vnpu-smp
+	- Runs one program on N cores at once: every core is a VNPU of its
+	  own ( registers, MEM and pc ) on a host thread of its own, and all of
+	  them share VNPU_SHARED_WORDS words of memory ( struct VnpuShared in
+	  vnpu.h ) that 'L', 'S', 'X', 'C', 'F' and 'W' work on. '#' tells a
+	  core which one it is, which is the only way two cores running the
+	  same program end up doing something different.
+	- Shared words are host atomics, one cache line each, and so is every
+	  core's own state: cores only ever contend on what the program itself
+	  shares.
+	- A core that finds the barrier 'W' closed is backed out of it by
+	  VnpuRun(), like an op blocked on a port, and spins ( PortBackoff() )
+	  until the last core gets there. A core that halts leaves the barrier
+	  for good, so 'W' never waits on a core that isn't coming.
+	- -r runs the program that many times on every core ( fresh registers,
+	  the same shared memory ), -b times it on 1, 2, 4 .. N cores.
+	- Prints go to a buffer per core, written out in core order once all
+	  of them are done. The exit code is the one of the first core that
+	  didn't halt cleanly, see VnpuExitCode().
+*/
+
+#define CACHE_LINE 64
+#define MAX_CORES 4096
+
+struct Core
+{
+    _Alignas(CACHE_LINE) struct VNPU vm; // only ever touched by its own thread
+    pthread_t thread;
+    char *output;
+    size_t output_len;
+    FILE *out_file;
+    enum VnpuHalt reason;
+    unsigned long long runs; // runs that got to the end
+};
+
+struct VnpuProgram Prog;
+struct VnpuShared *Shared;
+struct Core *Cores;
+unsigned long long Repeat = 1;
+bool Verbose = false;
+
+// StartCores ( unsigned cores, bool print )
+// ⤷ Powers 'cores' cores on over fresh shared memory, runs them all to the
+//   end and returns how long that took. Prints are dropped unless 'print'.
+double StartCores(unsigned cores, bool print);
+
+// CoreMain ( void *arg )
+// ⤷ Thread of one struct Core: Repeat runs of Prog, then leaves the barrier
+void *CoreMain(void *arg);
+
+// Bench ( unsigned max_cores )
+// ⤷ Times Prog on 1, 2, 4 .. max_cores cores and prints how it scales
+int Bench(unsigned max_cores);
+
+void printSmpUsage(void);
+
+static double NowSec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// SharedValue ( int i )
+// ⤷ Shared word 'i' the way 'L' reads it
+static unsigned long long SharedValue(int i)
+{
+    uint64_t word = atomic_load(&Shared->mem[i].word);
+#if VNPU_WORD_SIZE < 64
+    word &= (UINT64_C(1) << VNPU_WORD_SIZE) - 1;
+#endif
+    return (unsigned long long)word;
+}
+
+// Restart ( struct VNPU *vm )
+// ⤷ Powers a core back on for another run: fresh registers, the same
+//   shared memory and core number, counters kept
+static void Restart(struct VNPU *vm)
+{
+    struct VNPU old = *vm;
+    VnpuReset(vm, old.out);
+    vm->shared = old.shared;
+    vm->core = old.core;
+    vm->insns = old.insns;
+    vm->cycles = old.cycles;
+    vm->out_bytes = old.out_bytes;
+}
+
+void *CoreMain(void *arg)
+{
+    struct Core *c = arg;
+
+    for (unsigned long long r = 0; r < Repeat; ++r)
+    {
+        if (r > 0) Restart(&c->vm);
+
+        unsigned spins = 0;
+        while ((c->reason = VnpuRun(&c->vm, &Prog)) == VNPU_RUNNING)
+            PortBackoff(&spins); // at a closed 'W'
+        c->runs++;
+        if (VnpuExitCode(c->reason) != 0) break;
+    }
+    VnpuSharedLeave(Shared);
+    return NULL;
+}
+
+double StartCores(unsigned cores, bool print)
+{
+    VnpuSharedInit(Shared, cores);
+    for (unsigned i = 0; i < cores; ++i)
+    {
+        struct Core *c = &Cores[i];
+        VnpuReset(&c->vm, print ? c->out_file : NULL);
+        c->vm.shared = Shared;
+        c->vm.core = i;
+        c->reason = VNPU_RUNNING;
+        c->runs = 0;
+    }
+
+    double start = NowSec();
+    for (unsigned i = 1; i < cores; ++i)
+        pthread_create(&Cores[i].thread, NULL, CoreMain, &Cores[i]);
+    CoreMain(&Cores[0]);
+    for (unsigned i = 1; i < cores; ++i)
+        pthread_join(Cores[i].thread, NULL);
+    return NowSec() - start;
+}
+
+int Bench(unsigned max_cores)
+{
+    printf("VNPU => %zu ops, %llu runs per core\n", Prog.len, Repeat);
+    printf("%6s %14s %10s %12s %8s %22s\n", "cores", "instructions", "seconds", "Minstr/s", "speedup", "MEM 0");
+
+    double base = 0;
+    for (unsigned n = 1; ; n = n * 2 < max_cores ? n * 2 : max_cores)
+    {
+        double elapsed = StartCores(n, false);
+        unsigned long long insns = 0;
+        for (unsigned i = 0; i < n; ++i)
+            insns += Cores[i].vm.insns;
+
+        double rate = elapsed > 0 ? (double)insns / elapsed : 0.0;
+        if (n == 1) base = rate;
+        printf("%6u %14llu %10.3f %12.1f %7.2fx %22llu\n", n, insns, elapsed, rate / 1e6,
+               base > 0 ? rate / base : 0.0, SharedValue(0));
+        if (n == max_cores) break;
+    }
+    return 0;
+}
+
+void printSmpUsage(void)
+{
+    fprintf
+    (
+        stderr,
+        "Usage: vnpu-smp [-n CORES] [-r RUNS] [-b] [-v] PROGRAM\n"
+        "  -n CORES  cores to run PROGRAM on, at most %d ( default: one per online core )\n"
+        "  -r RUNS   runs of PROGRAM per core ( default: 1, 100000 with -b )\n"
+        "  -b        time it on 1, 2, 4 .. CORES cores instead, printing nothing else\n"
+        "  -v        print a '==> core N <==' header before each core's output,\n"
+        "            why each core stopped and what the shared memory holds on stderr\n",
+        MAX_CORES
+    );
+}
+
+int main(int argc, char **argv)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    long long runs = -1;
+    bool bench = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:bvh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                cores = strtol(optarg, NULL, 10);
+                break;
+            case 'r':
+                runs = strtoll(optarg, NULL, 10);
+                break;
+            case 'b':
+                bench = true;
+                break;
+            case 'v':
+                Verbose = true;
+                break;
+            default:
+                printSmpUsage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || cores < 1 || cores > MAX_CORES || runs == 0 || runs < -1)
+    {
+        printSmpUsage();
+        return 1;
+    }
+    Repeat = runs > 0 ? (unsigned long long)runs : bench ? 100000 : 1;
+
+    const char *path = argv[optind];
+    if (!VnpuLoadFile(&Prog, path))
+    {
+        fprintf(stderr, "VNPU => ERROR: cannot load \"%s\".\n", path);
+        return 1;
+    }
+
+    Shared = aligned_alloc(CACHE_LINE, sizeof *Shared);
+    Cores = aligned_alloc(CACHE_LINE, (size_t)cores * sizeof *Cores);
+    if (!Shared || !Cores)
+    {
+        fprintf(stderr, "VNPU => ERROR: out of memory.\n");
+        return 1;
+    }
+    memset(Cores, 0, (size_t)cores * sizeof *Cores);
+
+    if (bench)
+    {
+        int status = Bench((unsigned)cores);
+        free(Cores);
+        free(Shared);
+        VnpuFree(&Prog);
+        return status;
+    }
+
+    for (long i = 0; i < cores; ++i)
+    {
+        Cores[i].out_file = open_memstream(&Cores[i].output, &Cores[i].output_len);
+        if (!Cores[i].out_file) return 1;
+    }
+    double elapsed = StartCores((unsigned)cores, true);
+
+    int status = 0;
+    unsigned long long insns = 0;
+    for (long i = 0; i < cores; ++i)
+    {
+        struct Core *c = &Cores[i];
+        fclose(c->out_file);
+        if (Verbose)
+            printf("==> core %ld <==\n", i);
+        fwrite(c->output, 1, c->output_len, stdout);
+        free(c->output);
+        insns += c->vm.insns;
+
+        int code = VnpuExitCode(c->reason);
+        if (code != 0 && status == 0) status = code;
+        if (Verbose)
+            fprintf(stderr, "VNPU => core %ld: %s after %llu runs, %llu instructions.\n",
+                    i, VnpuHaltName(c->reason), c->runs, c->vm.insns);
+    }
+
+    if (Verbose)
+    {
+        fprintf(stderr, "VNPU => shared:");
+        for (int i = 0; i < VNPU_SHARED_WORDS; ++i)
+            fprintf(stderr, " %llu", SharedValue(i));
+        fprintf(stderr, "\nVNPU => %ld cores, %llu instructions in %.3f s ( %.0f instructions/s ).\n",
+                cores, insns, elapsed, elapsed > 0 ? (double)insns / elapsed : 0.0);
+    }
+
+    free(Cores);
+    free(Shared);
+    VnpuFree(&Prog);
+    return status;
+}
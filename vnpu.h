@@ -0,0 +1,386 @@
+#ifndef VNPU_H
+#define VNPU_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "wide.h"
+
+// MACROS
+//
+// INSTR_LEN_LIMIT is 9 bytes-long: "X Y Z D" (8 characters + \0)
+#define INSTR_LEN_LIMIT 9
+// VNPU_REGS is how many registers there are, named 'A' onwards: AX, BX, CX ..
+// Just AX and BX unless built with more, up to 16 ( 'A'..'P' ): that turns
+// '@ C' from printing a 'C' into printing CX, so it's opt-in.
+#ifndef VNPU_REGS
+#define VNPU_REGS 2
+#endif
+#if VNPU_REGS < 2 || VNPU_REGS > 16
+#error "VNPU_REGS must be between 2 and 16"
+#endif
+// VNPU_WORD_SIZE, in bits. Build with -DVNPU_WORD_SIZE=32 for what dumb/vnpu32.c
+// tried to be, or anything up to 4096 for wide words.
+#ifndef VNPU_WORD_SIZE
+#define VNPU_WORD_SIZE 8
+#endif
+#if VNPU_WORD_SIZE < 1 || VNPU_WORD_SIZE > 64 * WIDE_MAX_LIMBS
+#error "VNPU_WORD_SIZE must be between 1 and 4096 bits"
+#endif
+// VNPU_LIMBS is how many 64-bit limbs hold one word
+#define VNPU_LIMBS ((VNPU_WORD_SIZE + 63) / 64)
+// VNPU_BLOCK_LEN is how many ops VnpuRun() executes between two budget checks
+#define VNPU_BLOCK_LEN 256
+// VNPU_PORT_COUNT is how many input and output ports 'I' and 'O' can address
+#define VNPU_PORT_COUNT 4
+// VNPU_PORT_PRINT is the output port '@ A' / '@ B' use when prints are routed
+#define VNPU_PORT_PRINT VNPU_PORT_COUNT
+// VNPU_SHARED_WORDS is how many words of shared memory 'L', 'S', 'X' and 'C' can address
+#define VNPU_SHARED_WORDS 10
+
+/*
+	VirtNanoProUni
+	- A virtual, 1 byte-sized processing unit that counts a whopping 12 instructions.
+	- Written in C programming language
+	========================
+	Virtual Nano Processing Unit specifications
+	- Limited to c.ca 1 Instruction / 337 ms
+	- 2 Registers ( up to 16, see VNPU_REGS ), Limited to Integers and simple
+	  mathematical operations and comparisons - All of them (AX, BX, ..) have
+	  8 bits of decimal memory - Though
+	  every non-binary assignment operation will result in an instant HALT
+	  of the entire system (VNPU)
+	- No Random Access Memory, limited to a bi-dimensional array of 2*8 bits
+	- No programmable interface, limited to simple instruction calls
+      as '+ 1 1' then '@ A' which will output '2' - This also shows how all
+      mathematical operations executed will store their result in the AX register
+	========================
+	VNPU Instruction Set (v'NIS)
+	-----REGISTERS------
+	'A': Register AX
+	'B': Register BX
+	'C'..'P': Registers CX..PX, as many as VNPU_REGS says
+	-----OPERATIONS-----
+	'+': Adds X by Y. (Example: '+ A B' adds register AX and BX and stores the result in AX)
+	     A destination can follow: '+ A B B' stores the result in BX instead
+	'-': Subtracts X by Y
+	'*': Multiplies X by Y
+	'/': Divides X by Y (Note: WILL halt if a division by 0 operation is attempted)
+	-----DATA/MOVEMENT--
+	'M': Almost 1:1 virtual MOV instruction (Example: 'M 5 A' moves 0101 into register AX,
+	     'M A B' copies AX into BX)
+	-----COMPARISON-----
+	'?': Compares X to Y (Example: '? A B')
+	'>': X GREATER THAN Y CHECK expression
+	'<': X LESSER THAN Y CHECK expression
+	'!': X NOT EQUAL TO Y CHECK expression
+	-----I/O PORTS------
+	'I': Reads the next word from input port X into Y (Example: 'I 0 A')
+	'O': Writes Y to output port X (Example: 'O 0 A')
+	------CONTROL-------
+	'@': Prints X value (Example: '@ A' will print the contents of register AX)
+	'.': Halts immediately
+	-----SHARED MEMORY-- ( multi-core machines only, illegal anywhere else )
+	'L': Loads shared word X into Y (Example: 'L 0 A'), acquire
+	'S': Stores Y into shared word X (Example: 'S 0 B'), release
+	'X': Adds Y to shared word X, AX gets what it held before (Example: 'X 0 1')
+	'C': Compare-and-swap: if shared word X holds AX it gets Y, AX gets what it held
+	'F': Fence, nothing moves across it
+	'W': Waits until every core still running is waiting here too
+	'#': Loads this core's number into X (Example: '# A')
+*/
+
+// Why the machine stopped. VNPU_RUNNING means it did not.
+enum VnpuHalt
+{
+    VNPU_RUNNING = 0,
+    VNPU_HALT_INSTR,   // '.' was executed
+    VNPU_HALT_ILLEGAL, // an illegal instruction was provided
+    VNPU_HALT_EOF,     // ran out of instructions ( HALT stays false, like fgets() hitting EOF )
+    VNPU_HALT_INSN_LIMIT,  // the budgets in struct VnpuLimits, one each
+    VNPU_HALT_CYCLE_LIMIT,
+    VNPU_HALT_TIME_LIMIT,
+    VNPU_HALT_OUTPUT_LIMIT,
+    VNPU_HALT_IN_CLOSED,   // 'I' found its input port empty for good
+    VNPU_HALT_DIVZERO      // '/' by zero, reported as an illegal instruction
+};
+
+enum VnpuPortStatus
+{
+    VNPU_PORT_OK = 0,
+    VNPU_PORT_BLOCKED, // empty ( reading ) or full ( writing ), try again later
+    VNPU_PORT_CLOSED   // reading: empty and nothing else will ever come
+};
+
+// Where 'I' and 'O' go. Both return an enum VnpuPortStatus; VNPU_PORT_BLOCKED
+// makes the op wait: VnpuRun() returns in front of it, to be called again later.
+// A machine without any ( vm->ports == NULL ) reads closed ports and writes nowhere.
+struct VnpuPortOps
+{
+    int (*In)(void *ctx, int port, uint64_t *val);
+    int (*Out)(void *ctx, int port, uint64_t val);
+    void *ctx;
+    bool print_out; // '@' on a register sends the word to Out( VNPU_PORT_PRINT ) instead
+};
+
+// A word of shared memory, alone on its cache line
+struct VnpuSharedWord
+{
+    _Alignas(64) _Atomic uint64_t word;
+};
+
+// What the cores of a multi-core VNPU share: shared memory and the barrier 'W'
+// waits on. Every access to it is atomic, so programs can't race on it:
+// 'X', 'C', 'F' and 'W' are sequentially consistent, 'L' only acquires and
+// 'S' only releases ( a store may still be waiting behind a later load of
+// another word, put an 'F' between them if that matters ).
+struct VnpuShared
+{
+    struct VnpuSharedWord mem[VNPU_SHARED_WORDS];
+    _Alignas(64) _Atomic uint64_t barrier; // cores still running << 32 | cores waiting
+    _Alignas(64) atomic_uint generation;   // bumped every time the barrier opens
+};
+
+// Per-run resource limits for untrusted programs. 0 means unlimited.
+struct VnpuLimits
+{
+    unsigned long long max_insns;   // ops executed by VnpuRun()
+    unsigned long long max_cycles;  // 337 ms ticks
+    unsigned long long max_wall_ms; // real time, from VnpuSetLimits() on
+    unsigned long long max_output;  // bytes printed
+};
+
+// The whole state of one VNPU. Everything that used to be a global lives here,
+// so any number of machines can run side by side in the same process.
+struct VNPU
+{
+    bool HALT; // 'false' for ! halted; 'true' for halted
+    enum VnpuHalt HaltReason;
+    bool log_flag;
+    bool throttle; // 'true' to honour the c.ca 1 Instruction / 337 ms clock
+
+    char InstructionBuffer[INSTR_LEN_LIMIT];
+
+    // Words are little-endian arrays of 64-bit limbs, always masked to VNPU_WORD_SIZE bits
+    uint64_t MEM[2][VNPU_LIMBS]; // The 2 MEMory slots' bit-width is equal to the PU's WORD size
+                                 // MEM[1] holds the low word of the last result, MEM[0] the high one
+    // R[0] is AX, R[1] is BX, and so on up to VNPU_REGS
+    union
+    {
+        uint64_t R[VNPU_REGS][VNPU_LIMBS];
+        struct
+        {
+            uint64_t AX[VNPU_LIMBS];
+            uint64_t BX[VNPU_LIMBS];
+        };
+    };
+
+    unsigned long long cycles; // 337 ms ticks consumed, whether slept or not
+    unsigned long long insns;  // ops executed by VnpuRun()
+    size_t pc;                 // next op to run when executing a VnpuProgram
+    FILE *out;                 // where '@', 'H' and error messages go
+    unsigned long long out_bytes;
+
+    struct VnpuLimits limits;
+    unsigned long long deadline; // CLOCK_MONOTONIC ms, 0 for none
+
+    struct VnpuProfile *prof;  // per-op counters, only touched when not NULL
+    struct VnpuPortOps *ports; // 'I' / 'O' backend, NULL for none
+    bool blocked;              // the last op has to wait on a port, see VnpuRun()
+
+    struct VnpuShared *shared; // multi-core memory, NULL for a uniprocessor
+    unsigned core;             // this core's number, what '#' reads
+    bool waiting;              // has arrived at the barrier, which was closed
+    unsigned wait_gen;         // at this generation
+};
+
+// One decoded line of v'NIS, exactly as the interactive loop would have seen it
+enum VnpuOpKind
+{
+    VNPU_OP_EXEC = 0, // goes through HandleInstruction()
+    VNPU_OP_HALT,     // single-char '.'
+    VNPU_OP_USAGE,    // single-char 'H'
+    VNPU_OP_ILLEGAL   // rejected by FindInstruction()
+};
+
+struct VnpuOp
+{
+    char kind;
+    char instr;
+    char com1;
+    char com2;
+    char com3; // where '+ - * /' put the result, '\0' for AX ( "X Y Z" )
+    int line;  // 1-based source line the op came from
+};
+
+struct VnpuProgram
+{
+    struct VnpuOp *ops;
+    size_t len;
+    size_t cap;
+};
+
+// How many times each op of a VnpuProgram ran and how many cycles it burnt,
+// indexed by pc
+struct VnpuProfile
+{
+    unsigned long long *insns;
+    unsigned long long *cycles;
+    size_t len;
+};
+
+// w ( int millisec )
+// ⤷ Syntax sugar / Wrapper for usleep() ( from <unistd.h> )
+void w(int millisec);
+
+// Tick ( struct VNPU *vm )
+// ⤷ Consumes one 337 ms instruction cycle, only sleeping through it if vm->throttle is set
+void Tick(struct VNPU *vm);
+
+// FindInstruction ( char InstrBuff[] )
+// ⤷ Simple helper to check if the user's input contains a valid
+//   call to an instruction or not and returns a value.
+// NOTE: MISLEADING FUNCTION NAME. VERY MISLEADING.
+char FindInstruction(char InstrBuff[]);
+
+// dec2bin2reg ( uint64_t reg[VNPU_LIMBS], const uint64_t val[] )
+// ⤷ Stores the low VNPU_WORD_SIZE bits of 'val' into a specific register
+void dec2bin2reg(uint64_t reg[VNPU_LIMBS], const uint64_t val[]);
+
+// dec2bin2mem ( struct VNPU *vm, const uint64_t result[2 * VNPU_LIMBS] )
+// ⤷ Same as the last function but for memory: the low 2 * VNPU_WORD_SIZE bits
+//   of a double-width result, low word in MEM[1], high word in MEM[0]
+void dec2bin2mem(struct VNPU *vm, const uint64_t result[2 * VNPU_LIMBS]);
+
+// HandleInstruction ( struct VNPU *vm,
+//                     char instr,
+//                     char com1,
+//                     char com2,
+//                     char com3
+//                   )
+// ⤷ This helper is the one that actually does the calls to the virtual instructions
+bool HandleInstruction(struct VNPU *vm, char instr, char com1, char com2, char com3);
+
+// VIRTUAL INSTRUCTIONS
+// ( com3 is the destination register, '\0' for AX )
+int AddInstruction(struct VNPU *vm, char com1, char com2, char com3);
+int SubInstruction(struct VNPU *vm, char com1, char com2, char com3);
+int MulInstruction(struct VNPU *vm, char com1, char com2, char com3);
+int DivInstruction(struct VNPU *vm, char com1, char com2, char com3);
+//
+int MovInstruction(struct VNPU *vm, char com1, char com2);
+//
+bool CmpInstruction(char com1, char com2);
+bool GrThInstruction(char com1, char com2);
+bool LsThInstruction(char com1, char com2);
+bool NotEqInstruction(char com1, char com2);
+//
+int InInstruction(struct VNPU *vm, char com1, char com2);
+int OutInstruction(struct VNPU *vm, char com1, char com2);
+//
+int LoadInstruction(struct VNPU *vm, char com1, char com2);
+int StoreInstruction(struct VNPU *vm, char com1, char com2);
+int XaddInstruction(struct VNPU *vm, char com1, char com2);
+int CasInstruction(struct VNPU *vm, char com1, char com2);
+int FenceInstruction(struct VNPU *vm);
+int WaitInstruction(struct VNPU *vm);
+int CoreInstruction(struct VNPU *vm, char com1);
+
+void PrntInstruction(struct VNPU *vm, char com1);
+void HaltInstruction(struct VNPU *vm);
+
+// OTHER FUNCTIONS (HELPERS)
+void printUsage(struct VNPU *vm);
+extern const char VnpuUsageText[]; // what printUsage() prints
+
+// RegisterIndex ( char c )
+// ⤷ Which register an operand names ( 0 for 'A', 1 for 'B' .. ), -1 for none
+int RegisterIndex(char c);
+
+// ResolveOperand ( struct VNPU *vm, char c, uint64_t val[VNPU_LIMBS] )
+// ⤷ A digit or a register's contents. Returns -1 for anything else.
+int ResolveOperand(struct VNPU *vm, char c, uint64_t val[VNPU_LIMBS]);
+
+// PrintWord ( struct VNPU *vm, const uint64_t word[VNPU_LIMBS] )
+// ⤷ Prints a word in decimal followed by a newline
+void PrintWord(struct VNPU *vm, const uint64_t word[VNPU_LIMBS]);
+
+// VnpuPrint ( struct VNPU *vm, const char *fmt, ... )
+// ⤷ printf() to vm->out. Every byte the machine prints goes through here,
+//   which is where the output budget is enforced. A NULL vm->out drops it all.
+void VnpuPrint(struct VNPU *vm, const char *fmt, ...);
+
+// MACHINE / PROGRAM API
+
+// VnpuReset ( struct VNPU *vm, FILE *out )
+// ⤷ Powers the machine on: zeroed registers and memory, unthrottled,
+//   printing to 'out'
+void VnpuReset(struct VNPU *vm, FILE *out);
+
+// VnpuDecode ( char InstrBuff[], struct VnpuOp *op )
+// ⤷ Decodes what fgets() left in an INSTR_LEN_LIMIT buffer the same way the
+//   interactive loop does ( stale bytes included ). Returns false for blank input.
+bool VnpuDecode(char InstrBuff[], struct VnpuOp *op);
+
+// VnpuStep ( struct VNPU *vm, const struct VnpuOp *op )
+// ⤷ Executes one decoded op. Returns false once the machine has halted
+//   ( or vm->blocked: the op has to wait on a port and did nothing ).
+bool VnpuStep(struct VNPU *vm, const struct VnpuOp *op);
+
+// VnpuLoad ( struct VnpuProgram *prog, const char *text, size_t len )
+// ⤷ Splits 'text' into INSTR_LEN_LIMIT chunks like fgets() would and decodes
+//   every one of them. Returns false if out of memory.
+bool VnpuLoad(struct VnpuProgram *prog, const char *text, size_t len);
+
+// VnpuLoadFile ( struct VnpuProgram *prog, const char *path )
+// ⤷ VnpuLoad() for a whole file. Returns false if it can't be read.
+bool VnpuLoadFile(struct VnpuProgram *prog, const char *path);
+
+// VnpuFree ( struct VnpuProgram *prog )
+void VnpuFree(struct VnpuProgram *prog);
+
+// VnpuRun ( struct VNPU *vm, const struct VnpuProgram *prog )
+// ⤷ Runs 'prog' from vm->pc until the machine halts or runs out of ops,
+//   filling in vm->prof along the way if it is set. An op that has to wait
+//   on a port stops it early: VNPU_RUNNING, vm->pc still pointing at that op.
+enum VnpuHalt VnpuRun(struct VNPU *vm, const struct VnpuProgram *prog);
+
+// VnpuSharedInit ( struct VnpuShared *shared, unsigned cores )
+// ⤷ Zeroed shared memory, and a barrier that opens once 'cores' cores wait at it
+void VnpuSharedInit(struct VnpuShared *shared, unsigned cores);
+
+// VnpuSharedLeave ( struct VnpuShared *shared )
+// ⤷ A core is done for good: the barrier stops waiting for it, and opens
+//   if everyone else was already there
+void VnpuSharedLeave(struct VnpuShared *shared);
+
+// VnpuSetLimits ( struct VNPU *vm, const struct VnpuLimits *limits )
+// ⤷ Arms the budgets for the following VnpuRun() calls; the wall clock starts now.
+//   Instruction and cycle budgets are counted down at block boundaries.
+void VnpuSetLimits(struct VNPU *vm, const struct VnpuLimits *limits);
+
+// VnpuOpCycles ( const struct VnpuOp *op )
+// ⤷ How many 337 ms cycles 'op' ticks when executed ( 0 or 1 )
+unsigned VnpuOpCycles(const struct VnpuOp *op);
+
+// VnpuExitCode ( enum VnpuHalt reason ) / VnpuHaltName ( enum VnpuHalt reason )
+// ⤷ Process exit code ( 0 for a clean halt ) and a human name for a halt reason
+int VnpuExitCode(enum VnpuHalt reason);
+const char *VnpuHaltName(enum VnpuHalt reason);
+
+// VnpuProfileInit ( struct VnpuProfile *prof, const struct VnpuProgram *prog )
+// ⤷ Zeroed counters for every op of 'prog'. Returns false if out of memory.
+bool VnpuProfileInit(struct VnpuProfile *prof, const struct VnpuProgram *prog);
+
+// VnpuProfileFree ( struct VnpuProfile *prof )
+void VnpuProfileFree(struct VnpuProfile *prof);
+
+// VnpuFormatOp ( const struct VnpuOp *op, char buf[8] )
+// ⤷ Writes the op back as v'NIS text ( "X Y Z D", "X Y Z", "." or "H" ) for reports,
+//   with anything unprintable shown as '?'
+void VnpuFormatOp(const struct VnpuOp *op, char buf[8]);
+
+#endif
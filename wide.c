@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "wide.h"
+
+// MulSchoolbook ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ Plain O(n^2) product, r has 2n limbs
+static void MulSchoolbook(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    for (size_t i = 0; i < 2 * n; ++i)
+        r[i] = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < n; ++j)
+        {
+            wide_u128 t = (wide_u128)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        r[i + n] = carry;
+    }
+}
+
+// AddInto ( uint64_t *r, size_t rn, const uint64_t *a, size_t an )
+// ⤷ r += a, carrying as far up r as needed
+static void AddInto(uint64_t *r, size_t rn, const uint64_t *a, size_t an)
+{
+    uint64_t carry = WideAdd(r, r, a, an);
+    for (size_t i = an; carry && i < rn; ++i)
+    {
+        r[i] += carry;
+        carry = r[i] == 0;
+    }
+}
+
+// SubInto ( uint64_t *r, size_t rn, const uint64_t *a, size_t an )
+// ⤷ r -= a, borrowing as far up r as needed ( r >= a )
+static void SubInto(uint64_t *r, size_t rn, const uint64_t *a, size_t an)
+{
+    uint64_t borrow = WideSub(r, r, a, an);
+    for (size_t i = an; borrow && i < rn; ++i)
+    {
+        borrow = r[i] == 0;
+        r[i]--;
+    }
+}
+
+// MulKaratsuba ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ a = a1*B^m + a0, b = b1*B^m + b0:
+//   a*b = z2*B^2m + ((a0+a1)(b0+b1) - z0 - z2)*B^m + z0
+static void MulKaratsuba(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    if (n < WIDE_KARATSUBA_THRESHOLD)
+    {
+        MulSchoolbook(r, a, b, n);
+        return;
+    }
+
+    size_t m = n / 2;     // low half
+    size_t h = n - m;     // high half, h >= m
+    uint64_t sa[WIDE_MAX_LIMBS], sb[WIDE_MAX_LIMBS];
+    uint64_t z1[2 * WIDE_MAX_LIMBS + 2];
+
+    // z0 and z2 go straight where they belong in r
+    MulKaratsuba(r, a, b, m);
+    MulKaratsuba(r + 2 * m, a + m, b + m, h);
+
+    // sa = a0 + a1, sb = b0 + b1 ( h limbs + a carry bit each )
+    WideCopy(sa, a + m, h);
+    WideCopy(sb, b + m, h);
+    uint64_t ca = 0, cb = 0;
+    {
+        uint64_t lo[WIDE_MAX_LIMBS] = {0};
+        WideCopy(lo, a, m);
+        ca = WideAdd(sa, sa, lo, h);
+        WideCopy(lo, b, m);
+        cb = WideAdd(sb, sb, lo, h);
+    }
+
+    // z1 = sa * sb + ( ca*sb + cb*sa ) * B^h + ca*cb * B^2h
+    MulKaratsuba(z1, sa, sb, h);
+    z1[2 * h] = 0;
+    z1[2 * h + 1] = 0;
+    if (ca) AddInto(z1 + h, h + 2, sb, h);
+    if (cb) AddInto(z1 + h, h + 2, sa, h);
+    if (ca && cb) AddInto(z1 + 2 * h, 2, (const uint64_t[]){1}, 1);
+
+    // z1 -= z0 + z2
+    SubInto(z1, 2 * h + 2, r, 2 * m);
+    SubInto(z1, 2 * h + 2, r + 2 * m, 2 * h);
+
+    // r += z1 * B^m, z1 fits in 2h + 1 limbs
+    size_t z1n = 2 * h + 2;
+    while (z1n > 0 && z1[z1n - 1] == 0) z1n--;
+    AddInto(r + m, 2 * n - m, z1, z1n);
+}
+
+void WideMulSlow(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    MulKaratsuba(r, a, b, n);
+}
+
+// DivSmall ( uint64_t *q, const uint64_t *a, uint64_t d, size_t n )
+// ⤷ q = a / d for a single-limb divisor, returns the remainder
+static uint64_t DivSmall(uint64_t *q, const uint64_t *a, uint64_t d, size_t n)
+{
+    uint64_t rem = 0;
+    for (size_t i = n; i-- > 0; )
+    {
+        wide_u128 cur = ((wide_u128)rem << 64) | a[i];
+        q[i] = (uint64_t)(cur / d);
+        rem = (uint64_t)(cur % d);
+    }
+    return rem;
+}
+
+void WideDivSlow(uint64_t *q, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    size_t bn = n;
+    while (bn > 1 && b[bn - 1] == 0) bn--;
+    if (bn == 1)
+    {
+        DivSmall(q, a, b[0], n);
+        return;
+    }
+
+    // Shift-subtract long division, starting from the top set bit of a
+    uint64_t rem[WIDE_MAX_LIMBS + 1] = {0};
+    size_t an = n;
+    while (an > 0 && a[an - 1] == 0) an--;
+    for (size_t i = 0; i < n; ++i) q[i] = 0;
+    if (an == 0) return;
+
+    size_t bits = 64 * an - (size_t)__builtin_clzll(a[an - 1]);
+    for (size_t bit = bits; bit-- > 0; )
+    {
+        // rem = rem << 1 | a[bit]
+        for (size_t i = bn; i > 0; --i)
+            rem[i] = (rem[i] << 1) | (rem[i - 1] >> 63);
+        rem[0] = (rem[0] << 1) | ((a[bit / 64] >> (bit % 64)) & 1);
+
+        if (rem[bn] || WideCmp(rem, b, bn) >= 0)
+        {
+            rem[bn] -= WideSub(rem, rem, b, bn);
+            q[bit / 64] |= UINT64_C(1) << (bit % 64);
+        }
+    }
+}
+
+size_t WideToDec(char *buf, size_t cap, const uint64_t *a, size_t n)
+{
+    // Peel off 19 digits at a time with single-limb divisions by 10^19
+    const uint64_t chunk = UINT64_C(10000000000000000000);
+    uint64_t cur[2 * WIDE_MAX_LIMBS]; // double words are fine too
+    uint64_t parts[2 * WIDE_MAX_LIMBS * 20 / 19 + 2];
+    size_t count = 0;
+
+    WideCopy(cur, a, n);
+    size_t cn = n;
+    do
+    {
+        parts[count++] = DivSmall(cur, cur, chunk, cn);
+        while (cn > 0 && cur[cn - 1] == 0) cn--;
+    } while (cn > 0);
+
+    size_t len = (size_t)snprintf(buf, cap, "%llu", (unsigned long long)parts[--count]);
+    while (count > 0 && len < cap)
+        len += (size_t)snprintf(buf + len, cap - len, "%019llu", (unsigned long long)parts[--count]);
+    return len;
+}
@@ -0,0 +1,150 @@
+#ifndef VNPU_WIDE_H
+#define VNPU_WIDE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+	Wide words
+	- A word is an array of 64-bit limbs, least significant limb first.
+	- The cheap kernels ( add / sub with carry chains, copies, compares )
+	  are inline here so that for the usual 1-limb word they boil down to
+	  a couple of instructions; multiplication, division and decimal
+	  conversion live in wide.c.
+*/
+
+// WIDE_MAX_LIMBS is enough for a 4096-bit word
+#define WIDE_MAX_LIMBS 64
+// Products of at least this many limbs per operand go through Karatsuba
+#define WIDE_KARATSUBA_THRESHOLD 24
+
+__extension__ typedef unsigned __int128 wide_u128;
+
+// WideAdd ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ r = a + b over n limbs, returns the carry out
+static inline uint64_t WideAdd(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    uint64_t carry = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t s = a[i] + carry;
+        carry = s < carry;
+        r[i] = s + b[i];
+        carry += r[i] < s;
+    }
+    return carry;
+}
+
+// WideSub ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ r = a - b over n limbs, returns the borrow out
+static inline uint64_t WideSub(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t d = a[i] - borrow;
+        borrow = a[i] < borrow;
+        borrow += d < b[i];
+        r[i] = d - b[i];
+    }
+    return borrow;
+}
+
+static inline void WideSet(uint64_t *r, uint64_t v, size_t n)
+{
+    r[0] = v;
+    for (size_t i = 1; i < n; ++i)
+        r[i] = 0;
+}
+
+static inline void WideCopy(uint64_t *r, const uint64_t *a, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        r[i] = a[i];
+}
+
+static inline bool WideIsZero(const uint64_t *a, size_t n)
+{
+    uint64_t any = 0;
+    for (size_t i = 0; i < n; ++i)
+        any |= a[i];
+    return any == 0;
+}
+
+// WideCmp ( const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ -1, 0 or 1 like memcmp(), but by value
+static inline int WideCmp(const uint64_t *a, const uint64_t *b, size_t n)
+{
+    for (size_t i = n; i-- > 0; )
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+// WideMask ( uint64_t *a, size_t bits, size_t n )
+// ⤷ Clears every bit of 'a' at or above 'bits'
+static inline void WideMask(uint64_t *a, size_t bits, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (bits >= 64 * (i + 1))
+            continue;
+        a[i] = bits <= 64 * i ? 0 : a[i] & ((UINT64_C(1) << (bits - 64 * i)) - 1);
+    }
+}
+
+// WideGetBits ( uint64_t *r, size_t n, const uint64_t *a, size_t an, size_t offset, size_t bits )
+// ⤷ r ( n limbs ) = 'bits' bits of 'a' ( an limbs ) starting at bit 'offset'
+static inline void WideGetBits(uint64_t *r, size_t n, const uint64_t *a, size_t an, size_t offset, size_t bits)
+{
+    size_t limb = offset / 64, shift = offset % 64;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t lo = limb + i < an ? a[limb + i] : 0;
+        uint64_t hi = limb + i + 1 < an ? a[limb + i + 1] : 0;
+        r[i] = shift ? (lo >> shift) | (hi << (64 - shift)) : lo;
+    }
+    WideMask(r, bits, n);
+}
+
+// WideMulSlow ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ r ( 2n limbs ) = a * b, schoolbook or Karatsuba depending on n
+void WideMulSlow(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n);
+
+// WideDivSlow ( uint64_t *q, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ q = a / b over n limbs, b != 0
+void WideDivSlow(uint64_t *q, const uint64_t *a, const uint64_t *b, size_t n);
+
+// WideMul ( uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ r ( 2n limbs ) = a * b
+static inline void WideMul(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    if (n == 1)
+    {
+        wide_u128 p = (wide_u128)a[0] * b[0];
+        r[0] = (uint64_t)p;
+        r[1] = (uint64_t)(p >> 64);
+        return;
+    }
+    WideMulSlow(r, a, b, n);
+}
+
+// WideDiv ( uint64_t *q, const uint64_t *a, const uint64_t *b, size_t n )
+// ⤷ q = a / b over n limbs, b != 0
+static inline void WideDiv(uint64_t *q, const uint64_t *a, const uint64_t *b, size_t n)
+{
+    if (n == 1)
+    {
+        q[0] = a[0] / b[0];
+        return;
+    }
+    WideDivSlow(q, a, b, n);
+}
+
+// WideToDec ( char *buf, size_t cap, const uint64_t *a, size_t n )
+// ⤷ Writes 'a' in decimal, NUL-terminated. 'cap' must fit 20 digits per limb
+//   plus the NUL, 'n' can be up to 2 * WIDE_MAX_LIMBS. Returns the number of digits.
+size_t WideToDec(char *buf, size_t cap, const uint64_t *a, size_t n);
+
+#endif